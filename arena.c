@@ -0,0 +1,99 @@
+#include "zc.h"
+
+// Size of the blocks objects are allocated in.  Larger objects get a block of
+// their own.
+#define ARENA_BLOCK_SIZE 65536
+
+// Alignment of allocated objects (enough for any type).
+#define ARENA_ALIGN 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    char _Alignas(ARENA_ALIGN) data[];
+};
+
+static struct arena_block *new_block(struct arena *arena, size_t size)
+{
+    struct arena_block *block = malloc(sizeof *block + size);
+    if (block == NULL)
+        fatal(NO_LOC, "out of memory");
+
+    block->size = size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block;
+}
+
+void *arena_alloc(struct arena *arena, size_t n)
+{
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    arena->n_bytes += n;
+    if (arena->n_bytes > arena->max_n_bytes)
+        arena->max_n_bytes = arena->n_bytes;
+
+    if (n > ARENA_BLOCK_SIZE / 4) {
+        // Put the block after the newest one so the free space in the newest
+        // block can still be used.
+        struct arena_block *block = new_block(arena, n);
+        if (block->next != NULL) {
+            arena->blocks = block->next;
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+        return block->data;
+    }
+
+    if (n > (size_t)(arena->end - arena->cur)) {
+        struct arena_block *block = new_block(arena, ARENA_BLOCK_SIZE);
+        arena->cur = block->data;
+        arena->end = block->data + ARENA_BLOCK_SIZE;
+    }
+
+    void *p = arena->cur;
+    arena->cur += n;
+    return p;
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t n)
+{
+    char *copy = arena_alloc(arena, n + 1);
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+void arena_reset(struct arena *arena)
+{
+    // Keep one block around, so an arena which is reset often does not have
+    // to allocate a new block each time.
+    struct arena_block *keep = NULL;
+
+    struct arena_block *block = arena->blocks;
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        if (keep == NULL && block->size == ARENA_BLOCK_SIZE) {
+            keep = block;
+            keep->next = NULL;
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+
+    arena->blocks = keep;
+    arena->cur = keep != NULL ? keep->data : NULL;
+    arena->end = keep != NULL ? keep->data + keep->size : NULL;
+    arena->n_bytes = 0;
+}
+
+// Free all objects in the arena and all memory it holds.
+void arena_free(struct arena *arena)
+{
+    arena_reset(arena);
+    free(arena->blocks);
+    arena->blocks = NULL;
+    arena->cur = NULL;
+    arena->end = NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Region allocator.  Objects are allocated by bumping a pointer through large
+// blocks and are never freed one by one; instead all objects in an arena are
+// freed at once when the arena is reset.
+struct arena {
+    struct arena_block *blocks; // Blocks allocated from, newest first.
+    char *cur;                  // Free space in the newest block.
+    char *end;
+    size_t n_bytes;             // Bytes allocated since the last reset.
+    size_t max_n_bytes;         // Largest value n_bytes has had.
+};
+
+void *arena_alloc(struct arena *arena, size_t n);
+char *arena_strndup(struct arena *arena, const char *s, size_t n);
+
+// Free all objects allocated in the arena.
+void arena_reset(struct arena *arena);
+
+// Free all objects in the arena and all memory it holds.
+void arena_free(struct arena *arena);
+
+#endif // !defined ARENA_H
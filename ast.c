@@ -1,61 +1,82 @@
 #include "zc.h"
 
 // Create a node with string value.
-struct ast *ast_new(struct loc *loc, enum ast_tag tag)
+struct ast *ast_new(loc_t loc, enum ast_tag tag)
 {
-    struct ast *ast = malloc(sizeof *ast);
+    struct ast *ast = arena_alloc(zc_arena, sizeof *ast);
     ast->loc = loc;
+    ast->type_gen = 0;
     ast->tag = tag;
     return ast;
 }
 
-// Create a node with string value.
-struct ast *ast_new_s(struct loc *loc, enum ast_tag tag, char *s)
+// Create a node with string value.  The string has to be an atom.
+struct ast *ast_new_s(loc_t loc, enum ast_tag tag, const char *s)
 {
-    struct ast_s *ast = malloc(sizeof *ast);
+    struct ast_s *ast = arena_alloc(zc_arena, sizeof *ast);
     ast->ast.tag = tag;
     ast->ast.loc = loc;
-    ast->s = strdup(s);
+    ast->ast.type_gen = 0;
+    ast->s = s;
     return (struct ast *)ast;
 }
 
 // Create a node with character array value.
-struct ast *ast_new_chars(struct loc *loc, enum ast_tag tag, char *s, size_t n)
+struct ast *ast_new_chars(loc_t loc, enum ast_tag tag, char *s, size_t n)
+{
+    struct ast_chars *ast = arena_alloc(zc_arena, sizeof *ast);
+    ast->ast.tag = tag;
+    ast->ast.loc = loc;
+    ast->ast.type_gen = 0;
+    ast->s = arena_strndup(zc_arena, s, n);
+    ast->n = n;
+    return (struct ast *)ast;
+}
+
+// Create a node with character array value which is not copied, so it has to
+// outlive the node.
+struct ast *ast_new_chars_ref(loc_t loc, enum ast_tag tag, const char *s,
+        size_t n)
 {
-    struct ast_chars *ast = malloc(sizeof *ast);
+    struct ast_chars *ast = arena_alloc(zc_arena, sizeof *ast);
     ast->ast.tag = tag;
     ast->ast.loc = loc;
-    ast->s = strdup(s);
+    ast->ast.type_gen = 0;
+    ast->s = (char *)s;
     ast->n = n;
     return (struct ast *)ast;
 }
 
 // Create a node with integer value.
-struct ast *ast_new_i(struct loc *loc, enum ast_tag tag, long long int i)
+struct ast *ast_new_i(loc_t loc, enum ast_tag tag, long long int i)
 {
-    struct ast_i *ast = malloc(sizeof *ast);
+    struct ast_i *ast = arena_alloc(zc_arena, sizeof *ast);
     ast->ast.tag = tag;
     ast->ast.loc = loc;
+    ast->ast.type_gen = 0;
     ast->i = i;
     return (struct ast *)ast;
 }
 
 // Create a node with float value.
-struct ast *ast_new_f(struct loc *loc, enum ast_tag tag, double f)
+struct ast *ast_new_f(loc_t loc, enum ast_tag tag, double f)
 {
-    struct ast_f *ast = malloc(sizeof *ast);
+    struct ast_f *ast = arena_alloc(zc_arena, sizeof *ast);
     ast->ast.tag = tag;
     ast->ast.loc = loc;
+    ast->ast.type_gen = 0;
     ast->f = f;
     return (struct ast *)ast;
 }
 
 // Create a node with children.
-struct ast *ast_new_ast(struct loc *loc, enum ast_tag tag, size_t n_childs, ...)
+struct ast *ast_new_ast(loc_t loc, enum ast_tag tag, size_t n_childs, ...)
 {
-    struct ast_ast *ast = malloc(sizeof *ast + n_childs * sizeof *ast->childs);
+    struct ast_ast *ast = arena_alloc(zc_arena, sizeof *ast +
+            n_childs * sizeof *ast->childs);
     ast->ast.tag = tag;
     ast->ast.loc = loc;
+    ast->ast.type_gen = 0;
     ast->n_childs = n_childs;
     
     va_list va;
@@ -68,16 +89,30 @@ struct ast *ast_new_ast(struct loc *loc, enum ast_tag tag, size_t n_childs, ...)
     return (struct ast *)ast;
 }
 
+// Create a node with n_childs children, which have to be set by the caller.
+struct ast *ast_new_n(loc_t loc, enum ast_tag tag, size_t n_childs)
+{
+    struct ast_ast *ast = arena_alloc(zc_arena, sizeof *ast +
+            n_childs * sizeof *ast->childs);
+    ast->ast.tag = tag;
+    ast->ast.loc = loc;
+    ast->ast.type_gen = 0;
+    ast->n_childs = n_childs;
+    return (struct ast *)ast;
+}
+
 // Create a node with the children from the nodes in the ast_list.
-struct ast *ast_new_list(struct loc *loc, enum ast_tag tag, struct ast_list *ast_list)
+struct ast *ast_new_list(loc_t loc, enum ast_tag tag, struct ast_list *ast_list)
 {
     size_t n_childs = 0;
     for (struct ast_list *i = ast_list; i != NULL; i = i->next)
         n_childs++;
 
-    struct ast_ast *ast = malloc(sizeof *ast + n_childs * sizeof *ast->childs);
+    struct ast_ast *ast = arena_alloc(zc_arena, sizeof *ast +
+            n_childs * sizeof *ast->childs);
     ast->ast.tag = tag;
     ast->ast.loc = loc;
+    ast->ast.type_gen = 0;
     ast->n_childs = n_childs;
 
     size_t i = 0;
@@ -235,7 +270,7 @@ bool ast_equals(struct ast *a, struct ast *b)
         case AST_NO_VAL:
             return true;
         case AST_S:
-            return strcmp(ast_s(a), ast_s(b));
+            return ast_s(a) == ast_s(b);
         case AST_I:
             return ast_i(a) == ast_i(b);
         case AST_F:
@@ -69,6 +69,7 @@
     X(PRE_INC_EXPR, 0x42D5) \
     X(PRE_DEC_EXPR, 0x42D6) \
     X(SIZEOF_EXPR, 0x42D7) \
+    X(OFFSETOF_EXPR, 0x42D8) \
     X(CAST_EXPR, 0x42E0) \
     X(DEREF_EXPR, 0x42F0) \
     X(SUBSCR_EXPR, 0x42F1) \
@@ -87,6 +88,7 @@
     X(CASE_LIST, 0x4403) \
     X(SOURCE_FILE, 0x4502) \
     X(STR_LIT, 0x5000) \
+    X(LAZY_BLOCK, 0x5001) \
     X(INVALID_AST_TAG, 0xFFFF)
 
 enum ast_tag {
@@ -106,14 +108,20 @@ enum ast_tag {
 // Node without an associated value.
 struct ast {
     enum ast_tag tag;
-    struct loc *loc; // Line number in source code.
+    unsigned type_gen;
+    loc_t loc; // Line number in source code.
     size_t n_refs;   // Reference counter.
+
+    // Type of the node cached by eval_type().  The cached type is only valid
+    // when type_gen equals zc_scope_gen and the same type is wanted.
+    struct type *type;
+    struct type *type_want;
 };
 
-// Node with a string value.
+// Node with a string value.  The string is an atom.
 struct ast_s {
     struct ast ast;
-    char *s;
+    const char *s;
 };
 
 // Node with a character array value.
@@ -182,15 +190,20 @@ static inline bool ast_has_ast(enum ast_tag tag)
 }
 
 // Create new nodes, with associated value.
-struct ast *ast_new(struct loc *loc, enum ast_tag tag);
-struct ast *ast_new_s(struct loc *loc, enum ast_tag tag, char *s);
-struct ast *ast_new_chars(struct loc *loc, enum ast_tag tag, char *s, size_t n);
-struct ast *ast_new_i(struct loc *loc, enum ast_tag tag, long long int i);
-struct ast *ast_new_f(struct loc *loc, enum ast_tag tag, double f);
-struct ast *ast_new_ast(struct loc *loc, enum ast_tag tag, size_t n_childs, ...);
+struct ast *ast_new(loc_t loc, enum ast_tag tag);
+struct ast *ast_new_s(loc_t loc, enum ast_tag tag, const char *s);
+struct ast *ast_new_chars(loc_t loc, enum ast_tag tag, char *s, size_t n);
+struct ast *ast_new_chars_ref(loc_t loc, enum ast_tag tag, const char *s,
+        size_t n);
+struct ast *ast_new_i(loc_t loc, enum ast_tag tag, long long int i);
+struct ast *ast_new_f(loc_t loc, enum ast_tag tag, double f);
+struct ast *ast_new_ast(loc_t loc, enum ast_tag tag, size_t n_childs, ...);
+
+// Create a node with n_childs children, which have to be set by the caller.
+struct ast *ast_new_n(loc_t loc, enum ast_tag tag, size_t n_childs);
 
 // Create a node with the children from the nodes in the ast_list.
-struct ast *ast_new_list(struct loc *loc, enum ast_tag tag, struct ast_list *ast_list);
+struct ast *ast_new_list(loc_t loc, enum ast_tag tag, struct ast_list *ast_list);
 
 // Create new node in linked list of nodes.
 struct ast_list *ast_list_new(struct ast *ast);
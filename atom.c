@@ -0,0 +1,113 @@
+#include "zc.h"
+
+// Size of the blocks the atom strings are allocated in.
+#define ATOM_BLOCK_SIZE 65536
+
+// Initial number of slots in the atom table (has to be a power of two).
+#define N_ATOM_SLOTS_INIT 1024
+
+struct atom_e {
+    const char *s;
+    size_t n;
+    uint64_t h;
+};
+
+// Hash table of all atoms.  Uses open addressing with linear probing.
+static struct {
+    struct atom_e *slots;
+    size_t n_slots;
+    size_t n_atoms;
+} atoms;
+
+// Current block the atom strings are allocated from.
+static struct {
+    char *data;
+    size_t n_left;
+} atom_block;
+
+/* hash string to 64-bit hash using the fnv-1a 64-bit hash function */
+static uint64_t strhash64(const char *s, size_t n)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < n; ++i) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211;
+	}
+	return h;
+}
+
+// Copy a string into the atom blocks.
+static const char *atom_copy(const char *s, size_t n)
+{
+    char *copy;
+
+    if (n + 1 > ATOM_BLOCK_SIZE / 4) {
+        copy = malloc(n + 1);
+    } else {
+        if (n + 1 > atom_block.n_left) {
+            atom_block.data = malloc(ATOM_BLOCK_SIZE);
+            atom_block.n_left = ATOM_BLOCK_SIZE;
+        }
+        copy = atom_block.data;
+        atom_block.data += n + 1;
+        atom_block.n_left -= n + 1;
+    }
+
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+// Double the number of slots in the atom table.
+static void atoms_grow(void)
+{
+    struct atom_e *old_slots = atoms.slots;
+    size_t n_old_slots = atoms.n_slots;
+
+    atoms.n_slots = n_old_slots ? n_old_slots * 2 : N_ATOM_SLOTS_INIT;
+    atoms.slots = calloc(atoms.n_slots, sizeof *atoms.slots);
+
+    size_t mask = atoms.n_slots - 1;
+    for (size_t i = 0; i < n_old_slots; ++i) {
+        if (old_slots[i].s == NULL)
+            continue;
+
+        size_t j = old_slots[i].h & mask;
+        while (atoms.slots[j].s != NULL)
+            j = (j + 1) & mask;
+        atoms.slots[j] = old_slots[i];
+    }
+
+    free(old_slots);
+}
+
+// Get the atom for the string s of length n (which does not need to be
+// null-terminated).
+const char *atom_new_n(const char *s, size_t n)
+{
+    if (2 * (atoms.n_atoms + 1) > atoms.n_slots)
+        atoms_grow();
+
+    uint64_t h = strhash64(s, n);
+    size_t mask = atoms.n_slots - 1;
+    size_t i = h & mask;
+
+    for (; atoms.slots[i].s != NULL; i = (i + 1) & mask) {
+        struct atom_e *e = &atoms.slots[i];
+        if (e->h == h && e->n == n && memcmp(e->s, s, n) == 0)
+            return e->s;
+    }
+
+    atoms.slots[i].s = atom_copy(s, n);
+    atoms.slots[i].n = n;
+    atoms.slots[i].h = h;
+    atoms.n_atoms++;
+
+    return atoms.slots[i].s;
+}
+
+// Get the atom for the null-terminated string s.
+const char *atom_new(const char *s)
+{
+    return atom_new_n(s, strlen(s));
+}
@@ -0,0 +1,10 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+// Atoms are unique copies of strings.  Every distinct string is stored once,
+// so atoms can be compared for equality by comparing pointers.  Atoms are
+// never freed.
+const char *atom_new(const char *s);
+const char *atom_new_n(const char *s, size_t n);
+
+#endif // !defined ATOM_H
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Write a chain of aliases to standard output, each defined from the previous
+# one twice, and a function which uses the last one 50 times.  Expanded in
+# full, the last alias has 2^n terms for the n given as the first argument.
+
+n=${1:-18}
+
+echo "g int = 1;"
+echo "define a0 g;"
+i=1
+while [ $i -le $n ]; do
+    echo "define a$i (a$((i - 1)) + a$((i - 1)) * 2);"
+    i=$((i + 1))
+done
+
+echo "main() int {"
+i=0
+while [ $i -lt 50 ]; do
+    echo "    g = a$n;"
+    i=$((i + 1))
+done
+echo "    return 0;"
+echo "}"
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Write a function returning an expression of the given number of terms,
+# x + x + ... + x, to standard output.  The expression is nested as deep as it
+# is long, which stresses type checking of expressions.
+
+n=${1:-10000}
+
+echo "f(x int) int {"
+printf '    return x'
+i=1
+while [ $i -lt $n ]; do
+    printf ' + x'
+    i=$((i + 1))
+done
+echo ";"
+echo "}"
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Write an input for the lexer benchmark to standard output, made of copies of
+# the example programs.  The first argument is the number of copies.
+
+n=${1:-2000}
+dir=$(dirname "$0")/../examples
+
+i=0
+while [ $i -lt $n ]; do
+    cat "$dir"/*.z
+    i=$((i + 1))
+done
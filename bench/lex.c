@@ -0,0 +1,40 @@
+// Lex the files given as arguments and print the time taken per token.
+
+#include "../zc.h"
+#include <time.h>
+
+int main(int argc, char **argv)
+{
+    long n_toks = 0;
+    size_t n_bytes = 0;
+    double secs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        struct lex_src src;
+        if (!lex_src_open(&src, argv[i])) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            return 1;
+        }
+        lex_cur = src.data;
+        lex_end = src.data + src.n;
+        linenr = 1;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int tok;
+        while ((tok = yylex()) != EOF_TOK) {
+            n_toks++;
+            if (tok == STR_TOK)
+                free(yylval.u.chars.s);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        secs += end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+        n_bytes += src.n;
+        lex_src_close(&src);
+    }
+
+    printf("%ld tokens, %.1f MB/s, %.1f ns/token\n", n_toks,
+            n_bytes / secs / 1e6, secs * 1e9 / n_toks);
+    return 0;
+}
@@ -0,0 +1,1124 @@
+#include "zc.h"
+
+// Version of the format of the cache entries.  It has to be changed when the
+// format, or the AST produced by the parser, changes.
+#define CACHE_FORMAT_VERSION 2
+
+// Magic numbers at the start of the entries of each kind.
+#define AST_MAGIC "ZAST"
+#define MANIFEST_MAGIC "ZMAN"
+#define FRAGS_MAGIC "ZFRG"
+#define OBJ_MAGIC "ZOBJ"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Hash identifying the compiler, or zero if it could not be computed, and the
+// data it is a hash of.
+static uint64_t compiler_hash;
+static uint64_t compiler_id[4];
+static bool has_compiler_hash;
+
+// Text identifying GCC, or NULL if it could not be found.
+static char *gcc_id;
+static bool has_gcc_id;
+
+// Names and descriptions of the statistics, and the counts of this process.
+static const char *stat_names[N_CACHE_STATS] = {
+    [CACHE_SOURCE_HIT] = "source_hits",
+    [CACHE_C_HIT] = "c_hits",
+    [CACHE_MISS] = "misses",
+    [CACHE_INCLUDE_HIT] = "include_hits",
+    [CACHE_INCLUDE_MISS] = "include_misses",
+    [CACHE_FUNC_HIT] = "function_hits",
+    [CACHE_FUNC_MISS] = "function_misses",
+    [CACHE_SHARD_HIT] = "shard_hits",
+    [CACHE_SHARD_MISS] = "shard_misses",
+};
+
+static const char *stat_descs[N_CACHE_STATS] = {
+    [CACHE_SOURCE_HIT] = "hits by source and includes",
+    [CACHE_C_HIT] = "hits by generated C code",
+    [CACHE_MISS] = "misses",
+    [CACHE_INCLUDE_HIT] = "included file hits",
+    [CACHE_INCLUDE_MISS] = "included file misses",
+    [CACHE_FUNC_HIT] = "function hits",
+    [CACHE_FUNC_MISS] = "function misses",
+    [CACHE_SHARD_HIT] = "shard hits",
+    [CACHE_SHARD_MISS] = "shard misses",
+};
+
+static uint64_t stats[N_CACHE_STATS];
+
+/* hash bytes with the fnv-1a 64-bit hash function, starting from hash h */
+uint64_t cache_hash(uint64_t h, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// Get the hash identifying the compiler.  The compiler is identified by the
+// size and modification time of its executable, so entries written by another
+// build are not used.
+static uint64_t get_compiler_hash(void)
+{
+    if (!has_compiler_hash) {
+        struct stat st;
+        if (stat("/proc/self/exe", &st) == 0) {
+            uint64_t id[] = { CACHE_FORMAT_VERSION, st.st_size,
+                st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+            memcpy(compiler_id, id, sizeof id);
+            compiler_hash = cache_hash(FNV_OFFSET, id, sizeof id);
+        }
+        has_compiler_hash = true;
+    }
+
+    return compiler_hash;
+}
+
+// Start gcc with one option, writing to a pipe.  Returns the file descriptor
+// of the pipe, or -1 if gcc could not be started.
+static int start_gcc_query(const char *opt, pid_t *pid)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        return -1;
+
+    *pid = fork();
+    if (*pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        execlp("gcc", "gcc", opt, (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    if (*pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+    return fds[0];
+}
+
+// Read the output of a gcc started by start_gcc_query() as a line, into buf of
+// size n.  Returns false if gcc failed.
+static bool finish_gcc_query(int fd, pid_t pid, char *buf, size_t n)
+{
+    size_t len = 0;
+    ssize_t r;
+    while ((r = read(fd, buf + len, n - 1 - len)) > 0 ||
+            (r < 0 && errno == EINTR))
+        len += r > 0 ? r : 0;
+    close(fd);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+
+    if (len == 0 || buf[len - 1] != '\n' || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+        return false;
+    buf[len - 1] = '\0';
+    return true;
+}
+
+// Get the text identifying GCC: its version and target, and the path, device,
+// inode, size and modification time of the cc1 it runs.  GCC is asked for them,
+// as the gcc found in PATH is only the driver.  The queries run in parallel.
+static const char *get_gcc_id(void)
+{
+    if (has_gcc_id)
+        return gcc_id;
+    has_gcc_id = true;
+
+    static const char *opts[] = {
+        "-dumpfullversion", "-dumpmachine", "-print-prog-name=cc1",
+    };
+    char out[ARRAY_LEN(opts)][PATH_MAX];
+    int fds[ARRAY_LEN(opts)];
+    pid_t pids[ARRAY_LEN(opts)];
+
+    for (size_t i = 0; i < ARRAY_LEN(opts); i++)
+        fds[i] = start_gcc_query(opts[i], &pids[i]);
+
+    bool ok = true;
+    for (size_t i = 0; i < ARRAY_LEN(opts); i++) {
+        if (fds[i] < 0)
+            ok = false;
+        else if (!finish_gcc_query(fds[i], pids[i], out[i], sizeof out[i]))
+            ok = false;
+    }
+
+    struct stat st;
+    if (!ok || stat(out[2], &st) != 0 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    if (asprintf(&gcc_id, "%s\n%s\n%s\n%llu %llu %llu %lld %ld", out[0],
+                out[1], out[2], (unsigned long long)st.st_dev,
+                (unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+                (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+
+    return gcc_id;
+}
+
+// Continue a digest with n bytes of data.  The size is part of the digest, so
+// concatenations differ.
+static struct cache_digest digest_bytes(struct cache_digest d,
+        const void *data, size_t n)
+{
+    if (!d.valid)
+        return d;
+
+    struct sha256 ctx;
+    uint64_t n64 = n;
+    sha256_init(&ctx);
+    sha256_update(&ctx, d.bytes, sizeof d.bytes);
+    sha256_update(&ctx, &n64, sizeof n64);
+    sha256_update(&ctx, data, n);
+    sha256_final(&ctx, d.bytes);
+    return d;
+}
+
+struct cache_digest cache_compile_digest(void)
+{
+    struct cache_digest d = { 0 };
+    if (zc_cache_dir == NULL || get_compiler_hash() == 0 ||
+            get_gcc_id() == NULL)
+        return d;
+
+    d.valid = true;
+    d = digest_bytes(d, compiler_id, sizeof compiler_id);
+    return digest_bytes(d, gcc_id, strlen(gcc_id));
+}
+
+struct cache_digest cache_digest_str(struct cache_digest d, const char *s)
+{
+    return digest_bytes(d, s, strlen(s));
+}
+
+struct cache_digest cache_digest_file(struct cache_digest d, const char *path)
+{
+    if (!d.valid)
+        return d;
+
+    struct lex_src src;
+    if (!lex_src_open(&src, path))
+        return (struct cache_digest){ 0 };
+
+    d = digest_bytes(d, src.data, src.n);
+    lex_src_close(&src);
+    return d;
+}
+
+uint64_t cache_hash_str(uint64_t h, const char *s)
+{
+    // Include the terminating null so concatenations differ.
+    return cache_hash(h, s, strlen(s) + 1);
+}
+
+uint64_t cache_key(const void *data, size_t n)
+{
+    if (zc_cache_dir == NULL || get_compiler_hash() == 0)
+        return 0;
+
+    uint64_t n64 = n;
+    uint64_t h = cache_hash(get_compiler_hash(), &n64, sizeof n64);
+    h = cache_hash(h, data, n);
+    return h != 0 ? h : 1;
+}
+
+uint64_t cache_hash_ast(uint64_t h, struct ast *ast)
+{
+    if (ast == NULL)
+        return cache_hash(h, "", 1);
+
+    uint32_t tag = ast->tag;
+    h = cache_hash(h, &tag, sizeof tag);
+
+    switch (ast_val_type(ast->tag)) {
+        case AST_NO_VAL:
+            break;
+        case AST_S:
+            h = cache_hash_str(h, ast_s(ast));
+            break;
+        case AST_I: {
+            int64_t i = ast_i(ast);
+            h = cache_hash(h, &i, sizeof i);
+            break;
+        }
+        case AST_F: {
+            double f = ast_f(ast);
+            h = cache_hash(h, &f, sizeof f);
+            break;
+        }
+        case AST_CHARS: {
+            size_t n;
+            const char *s = ast_chars(ast, &n);
+            uint64_t n64 = n;
+            h = cache_hash(h, &n64, sizeof n64);
+            h = cache_hash(h, s, n);
+            break;
+        }
+        case AST_AST: {
+            size_t n_childs;
+            struct ast **childs = ast_asts(ast, &n_childs);
+            uint64_t n64 = n_childs;
+            h = cache_hash(h, &n64, sizeof n64);
+            for (size_t i = 0; i < n_childs; ++i)
+                h = cache_hash_ast(h, childs[i]);
+            break;
+        }
+    }
+
+    return h;
+}
+
+// Get the path of the cache entry for key, with a file extension for the kind
+// of entry.  The path is allocated with malloc.
+static char *entry_path(uint64_t key, const char *ext)
+{
+    char *path;
+    if (asprintf(&path, "%s/%016llx.%s", zc_cache_dir,
+                (unsigned long long)key, ext) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+    return path;
+}
+
+// Create a directory and its parent directories.
+static void make_dirs(const char *path)
+{
+    char *p = strdup(path);
+    for (char *s = p + 1; *s != '\0'; ++s) {
+        if (*s == '/') {
+            *s = '\0';
+            mkdir(p, 0777);
+            *s = '/';
+        }
+    }
+    mkdir(p, 0777);
+    free(p);
+}
+
+// Create a temporary file next to the entry at path, and get its path, which
+// is allocated with malloc.  Returns -1 if the file cannot be created.
+static int create_tmp(const char *path, char **tmp_path)
+{
+    if (asprintf(tmp_path, "%s.XXXXXX", path) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+
+    int fd = mkstemp(*tmp_path);
+    if (fd < 0 && errno == ENOENT) {
+        // mkstemp() can leave the template changed when it fails.
+        make_dirs(zc_cache_dir);
+        sprintf(*tmp_path, "%s.XXXXXX", path);
+        fd = mkstemp(*tmp_path);
+    }
+
+    return fd;
+}
+
+// Write the cache entry for key.  The data is written to a temporary file
+// which is renamed, so other processes never see a partial entry.
+static void write_entry(uint64_t key, const char *ext, const void *data,
+        size_t n)
+{
+    char *path = entry_path(key, ext);
+    char *tmp_path;
+    int fd = create_tmp(path, &tmp_path);
+
+    if (fd >= 0) {
+        bool ok = write(fd, data, n) == (ssize_t)n;
+        if (close(fd) == 0 && ok)
+            rename(tmp_path, path);
+        else
+            unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    free(path);
+}
+
+// The tags in ascending order.  A tag is written as its index in this table,
+// which fits in one byte.
+static const enum ast_tag ast_tags[] = {
+#define tag_elem(NAME, VAL) NAME,
+    EXPAND_AST_TAGS(tag_elem)
+#undef tag_elem
+};
+
+static size_t tag_index(enum ast_tag tag)
+{
+    size_t lo = 0, hi = ARRAY_LEN(ast_tags);
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ast_tags[mid] <= tag)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    assert(ast_tags[lo] == tag);
+    return lo;
+}
+
+// Convert between signed integers and unsigned integers with small values for
+// small negative integers.
+static uint64_t zigzag(int64_t i)
+{
+    return (uint64_t)i << 1 ^ -((uint64_t)i >> 63);
+}
+
+static int64_t unzigzag(uint64_t u)
+{
+    return (int64_t)(u >> 1 ^ -(u & 1));
+}
+
+// Serialized AST being written.  Strings are written once; later occurrences
+// of a string refer to it by its index.  Line numbers are written relative to
+// the line of the previous node.
+struct writer {
+    char *data;
+    size_t n;
+    size_t max_n;
+    struct strmap *strs; // Index plus one of each string written.
+    size_t n_strs;
+    int line;
+};
+
+static void put_bytes(struct writer *w, const void *data, size_t n)
+{
+    if (w->n + n > w->max_n) {
+        while (w->n + n > w->max_n)
+            w->max_n = w->max_n ? w->max_n * 2 : 4096;
+        w->data = realloc(w->data, w->max_n);
+    }
+
+    memcpy(w->data + w->n, data, n);
+    w->n += n;
+}
+
+// Write an unsigned integer with seven bits in each byte, least significant
+// first.  The high bit is set in all bytes except the last.
+static void put_uint(struct writer *w, uint64_t u)
+{
+    unsigned char b[10];
+    size_t n = 0;
+
+    do {
+        b[n] = u & 0x7F;
+        u >>= 7;
+        if (u != 0)
+            b[n] |= 0x80;
+        n++;
+    } while (u != 0);
+
+    put_bytes(w, b, n);
+}
+
+// Write a string, which has to be an atom.
+static void put_str(struct writer *w, const char *s)
+{
+    size_t index = (size_t)strmap_get(w->strs, s);
+    if (index != 0) {
+        put_uint(w, index - 1);
+        return;
+    }
+
+    size_t n = strlen(s);
+    put_uint(w, w->n_strs);
+    put_uint(w, n);
+    put_bytes(w, s, n);
+    strmap_add(w->strs, s, (void *)++w->n_strs);
+}
+
+// Write the tag and line of a node.
+static void put_node(struct writer *w, struct ast *ast)
+{
+    put_uint(w, tag_index(ast->tag) + 1);
+    put_uint(w, zigzag(loc_line(ast->loc) - w->line));
+    w->line = loc_line(ast->loc);
+}
+
+static void put_ast(struct writer *w, struct ast *ast)
+{
+    if (ast == NULL) {
+        put_uint(w, 0);
+        return;
+    }
+
+    put_node(w, ast);
+
+    switch (ast_val_type(ast->tag)) {
+        case AST_NO_VAL:
+            break;
+        case AST_S:
+            put_str(w, ast_s(ast));
+            break;
+        case AST_I:
+            put_uint(w, zigzag(ast_i(ast)));
+            break;
+        case AST_F: {
+            double f = ast_f(ast);
+            put_bytes(w, &f, sizeof f);
+            break;
+        }
+        case AST_CHARS: {
+            size_t n;
+            const char *s = ast_chars(ast, &n);
+            put_uint(w, n);
+            put_bytes(w, s, n);
+            break;
+        }
+        case AST_AST: {
+            size_t n_childs;
+            struct ast **childs = ast_asts(ast, &n_childs);
+            put_uint(w, n_childs);
+            for (size_t i = 0; i < n_childs; ++i)
+                put_ast(w, childs[i]);
+            break;
+        }
+    }
+}
+
+// Write the header of an entry, which identifies the kind of entry and its key
+// of key_size bytes.
+static void put_header(struct writer *w, const char *magic, const void *key,
+        size_t key_size)
+{
+    put_bytes(w, magic, 4);
+    put_uint(w, CACHE_FORMAT_VERSION);
+    put_bytes(w, key, key_size);
+}
+
+void cache_store_ast(uint64_t key, struct ast *ast, struct ast **includes,
+        size_t n_includes)
+{
+    struct writer w = { .strs = strmap_new(0) };
+
+    put_header(&w, AST_MAGIC, &key, sizeof key);
+
+    // The ASTs of the included files are not stored, as they depend on which
+    // files have already been included.
+    size_t n_childs;
+    struct ast **childs = ast_asts(ast, &n_childs);
+
+    put_node(&w, ast);
+    put_uint(&w, n_childs);
+
+    size_t include = 0;
+    for (size_t i = 0; i < n_childs; ++i) {
+        enum ast_tag tag = childs[i]->tag;
+        if (tag == SOURCE_FILE || tag == ALREADY_INCLUDED) {
+            assert(include < n_includes);
+            put_ast(&w, includes[include++]);
+        } else {
+            put_ast(&w, childs[i]);
+        }
+    }
+
+    write_entry(key, "zast", w.data, w.n);
+    strmap_del(w.strs, NULL);
+    free(w.data);
+}
+
+// Serialized AST being read.  err is set if the data is not valid.
+struct reader {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool err;
+    const char **strs;
+    size_t n_strs;
+    size_t max_strs;
+    unsigned file;
+    int line;
+};
+
+static const void *get_bytes(struct reader *r, size_t n)
+{
+    if (r->err || (size_t)(r->end - r->p) < n) {
+        r->err = true;
+        return NULL;
+    }
+
+    const void *p = r->p;
+    r->p += n;
+    return p;
+}
+
+static uint64_t get_uint(struct reader *r)
+{
+    uint64_t u = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        const unsigned char *b = get_bytes(r, 1);
+        if (b == NULL)
+            return 0;
+
+        u |= (uint64_t)(*b & 0x7F) << shift;
+        if (!(*b & 0x80))
+            return u;
+    }
+
+    r->err = true;
+    return 0;
+}
+
+static const char *get_str(struct reader *r)
+{
+    uint64_t index = get_uint(r);
+    if (index < r->n_strs)
+        return r->strs[index];
+
+    if (index != r->n_strs) {
+        r->err = true;
+        return NULL;
+    }
+
+    uint64_t n = get_uint(r);
+    const char *s = get_bytes(r, n);
+    if (s == NULL)
+        return NULL;
+
+    if (r->n_strs == r->max_strs) {
+        r->max_strs = r->max_strs ? r->max_strs * 2 : 256;
+        r->strs = realloc(r->strs, r->max_strs * sizeof *r->strs);
+    }
+
+    return r->strs[r->n_strs++] = atom_new_n(s, n);
+}
+
+static struct ast *get_ast(struct reader *r)
+{
+    uint64_t index = get_uint(r);
+    if (index == 0 || r->err)
+        return NULL;
+
+    if (index > ARRAY_LEN(ast_tags)) {
+        r->err = true;
+        return NULL;
+    }
+
+    enum ast_tag tag = ast_tags[index - 1];
+    r->line += unzigzag(get_uint(r));
+    loc_t loc = loc_new(r->file, r->line);
+
+    switch (ast_val_type(tag)) {
+        case AST_NO_VAL:
+            return ast_new(loc, tag);
+        case AST_S: {
+            const char *s = get_str(r);
+            return s != NULL ? ast_new_s(loc, tag, s) : NULL;
+        }
+        case AST_I: {
+            return ast_new_i(loc, tag, unzigzag(get_uint(r)));
+        }
+        case AST_F: {
+            double f;
+            const void *p = get_bytes(r, sizeof f);
+            if (p == NULL)
+                return NULL;
+            memcpy(&f, p, sizeof f);
+            return ast_new_f(loc, tag, f);
+        }
+        case AST_CHARS: {
+            uint64_t n = get_uint(r);
+            const char *s = get_bytes(r, n);
+            return s != NULL ? ast_new_chars(loc, tag, (char *)s, n) : NULL;
+        }
+        case AST_AST: {
+            uint64_t n_childs = get_uint(r);
+            if (n_childs > (uint64_t)(r->end - r->p)) {
+                r->err = true;
+                return NULL;
+            }
+
+            struct ast *ast = ast_new_n(loc, tag, n_childs);
+            struct ast **childs = ast_asts(ast, &(size_t){ 0 });
+            for (size_t i = 0; i < n_childs; ++i)
+                childs[i] = get_ast(r);
+            return ast;
+        }
+    }
+
+    r->err = true;
+    return NULL;
+}
+
+// Open the cache entry named name and read its header.  Returns false if there
+// is no entry with the magic number and the key of key_size bytes.
+static bool open_entry(struct lex_src *src, struct reader *r, uint64_t name,
+        const void *key, size_t key_size, const char *ext, const char *magic)
+{
+    char *path = entry_path(name, ext);
+    bool found = lex_src_open(src, path);
+    free(path);
+
+    if (!found)
+        return false;
+
+    *r = (struct reader){
+        .p = (unsigned char *)src->data,
+        .end = (unsigned char *)src->data + src->n,
+    };
+
+    const char *entry_magic = get_bytes(r, 4);
+    uint64_t version = get_uint(r);
+    const void *entry_key = get_bytes(r, key_size);
+
+    if (r->err || memcmp(entry_magic, magic, 4) != 0 ||
+            version != CACHE_FORMAT_VERSION ||
+            memcmp(entry_key, key, key_size) != 0) {
+        lex_src_close(src);
+        return false;
+    }
+
+    return true;
+}
+
+struct ast *cache_load_ast(uint64_t key, unsigned file)
+{
+    struct lex_src src;
+    struct reader r;
+    if (!open_entry(&src, &r, key, &key, sizeof key, "zast", AST_MAGIC))
+        return NULL;
+
+    r.file = file;
+    struct ast *ast = get_ast(&r);
+
+    if (r.err || r.p != r.end || ast == NULL || ast->tag != SOURCE_FILE)
+        ast = NULL;
+
+    free(r.strs);
+    lex_src_close(&src);
+    return ast;
+}
+
+// Get the name of the entry for a digest, which is the start of the digest.
+static uint64_t digest_name(struct cache_digest d)
+{
+    uint64_t name;
+    memcpy(&name, d.bytes, sizeof name);
+    return name;
+}
+
+void cache_store_manifest(struct cache_digest key, struct include_dep *deps,
+        size_t n_deps, struct cache_digest result)
+{
+    struct writer w = { .strs = strmap_new(0) };
+
+    put_header(&w, MANIFEST_MAGIC, key.bytes, sizeof key.bytes);
+    put_uint(&w, n_deps);
+    for (size_t i = 0; i < n_deps; ++i) {
+        put_str(&w, deps[i].path);
+        put_str(&w, deps[i].real_path);
+        put_uint(&w, deps[i].key != 0);
+        if (deps[i].key != 0)
+            put_bytes(&w, deps[i].digest, sizeof deps[i].digest);
+    }
+    put_bytes(&w, result.bytes, sizeof result.bytes);
+
+    write_entry(digest_name(key), "zman", w.data, w.n);
+    strmap_del(w.strs, NULL);
+    free(w.data);
+}
+
+// Check if an include resolves to the same file as when it was recorded, and
+// if digest is not NULL, if the file has the same content.
+static bool dep_is_valid(const char *path, const char *real,
+        const unsigned char *digest)
+{
+    char *real_path = realpath(path, NULL);
+    if (real_path == NULL)
+        return false;
+
+    bool valid = strcmp(real_path, real) == 0;
+    free(real_path);
+
+    if (valid && digest != NULL) {
+        struct lex_src src;
+        if (!lex_src_open(&src, path))
+            return false;
+
+        unsigned char content[SHA256_SIZE];
+        sha256(src.data, src.n, content);
+        valid = memcmp(content, digest, sizeof content) == 0;
+        lex_src_close(&src);
+    }
+
+    return valid;
+}
+
+bool cache_load_manifest(struct cache_digest key, struct cache_digest *result)
+{
+    struct lex_src src;
+    struct reader r;
+    if (!key.valid || !open_entry(&src, &r, digest_name(key), key.bytes,
+                sizeof key.bytes, "zman", MANIFEST_MAGIC))
+        return false;
+
+    bool valid = true;
+    uint64_t n_deps = get_uint(&r);
+    for (uint64_t i = 0; i < n_deps && valid && !r.err; ++i) {
+        const char *path = get_str(&r);
+        const char *real = get_str(&r);
+        const void *digest = get_uint(&r) ? get_bytes(&r, SHA256_SIZE) : NULL;
+
+        if (!r.err)
+            valid = dep_is_valid(path, real, digest);
+    }
+
+    const void *p = get_bytes(&r, sizeof result->bytes);
+    valid = valid && !r.err && r.p == r.end;
+    if (valid) {
+        result->valid = true;
+        memcpy(result->bytes, p, sizeof result->bytes);
+    }
+
+    free(r.strs);
+    lex_src_close(&src);
+    return valid;
+}
+
+struct cache_digest cache_deps_digest(struct cache_digest key,
+        struct include_dep *deps, size_t n_deps)
+{
+    for (size_t i = 0; i < n_deps; ++i) {
+        key = cache_digest_str(key, deps[i].path);
+        key = cache_digest_str(key, deps[i].real_path);
+
+        bool has_digest = deps[i].key != 0;
+        key = digest_bytes(key, &has_digest, sizeof has_digest);
+        if (has_digest)
+            key = digest_bytes(key, deps[i].digest, sizeof deps[i].digest);
+    }
+    return key;
+}
+
+bool cache_get_file(struct cache_digest key, const char *path)
+{
+    struct lex_src src;
+    struct reader r;
+    if (!key.valid || !open_entry(&src, &r, digest_name(key), key.bytes,
+                sizeof key.bytes, "zobj", OBJ_MAGIC))
+        return false;
+
+    size_t n = r.end - r.p;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool ok = fd >= 0 && write(fd, r.p, n) == (ssize_t)n;
+    if (fd >= 0 && close(fd) != 0)
+        ok = false;
+
+    lex_src_close(&src);
+    return ok;
+}
+
+void cache_put_file(struct cache_digest key, const char *path)
+{
+    struct lex_src src;
+    if (!key.valid || !lex_src_open(&src, path))
+        return;
+
+    struct writer w = { 0 };
+    put_header(&w, OBJ_MAGIC, key.bytes, sizeof key.bytes);
+    put_bytes(&w, src.data, src.n);
+    write_entry(digest_name(key), "zobj", w.data, w.n);
+    free(w.data);
+    lex_src_close(&src);
+}
+
+// Fragment table being written.  The temporary file is removed if the process
+// exits before the table is closed.
+struct frag_writer {
+    FILE *fp;
+    char *path;
+    char *tmp_path;
+    struct writer w;
+    bool err;
+};
+
+static char *pending_tmp_path;
+
+static void remove_pending_tmp(void)
+{
+    if (pending_tmp_path != NULL)
+        unlink(pending_tmp_path);
+}
+
+// Write a string with its terminating null, so it can be used where the entry
+// is mapped.
+static void put_text(struct writer *w, const char *s)
+{
+    size_t n = s != NULL ? strlen(s) : 0;
+    put_uint(w, n);
+    put_bytes(w, s != NULL ? s : "", n);
+    put_bytes(w, "", 1);
+}
+
+// Write the buffered data of a fragment table to its file.
+static void flush_frags(struct frag_writer *w)
+{
+    if (fwrite(w->w.data, 1, w->w.n, w->fp) != w->w.n)
+        w->err = true;
+    w->w.n = 0;
+}
+
+struct frag_writer *cache_open_frags(uint64_t key)
+{
+    if (key == 0)
+        return NULL;
+
+    char *path = entry_path(key, "zfrag");
+    char *tmp_path;
+    int fd = create_tmp(path, &tmp_path);
+
+    FILE *fp;
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        free(path);
+        return NULL;
+    }
+
+    static bool registered;
+    if (!registered) {
+        atexit(remove_pending_tmp);
+        registered = true;
+    }
+    pending_tmp_path = tmp_path;
+
+    struct frag_writer *w = malloc(sizeof *w);
+    *w = (struct frag_writer){ .fp = fp, .path = path, .tmp_path = tmp_path };
+    put_header(&w->w, FRAGS_MAGIC, &key, sizeof key);
+    return w;
+}
+
+void cache_put_frag(struct frag_writer *w, struct cache_frag *frag,
+        const char **helpers)
+{
+    if (w == NULL)
+        return;
+
+    put_uint(&w->w, 1);
+    put_bytes(&w->w, &frag->key, sizeof frag->key);
+    for (int i = 0; i < N_FRAG_TEXTS; ++i)
+        put_text(&w->w, frag->texts[i]);
+
+    put_uint(&w->w, frag->n_helpers);
+    for (size_t i = 0; i < 3 * frag->n_helpers; ++i)
+        put_text(&w->w, helpers[i]);
+
+    flush_frags(w);
+}
+
+void cache_close_frags(struct frag_writer *w, bool complete)
+{
+    if (w == NULL)
+        return;
+
+    put_uint(&w->w, 0);
+    flush_frags(w);
+
+    if (fclose(w->fp) == 0 && !w->err && complete)
+        rename(w->tmp_path, w->path);
+    else
+        unlink(w->tmp_path);
+
+    pending_tmp_path = NULL;
+    free(w->w.data);
+    free(w->tmp_path);
+    free(w->path);
+    free(w);
+}
+
+// Read a string written by put_text().
+static const char *get_text(struct reader *r)
+{
+    uint64_t n = get_uint(r);
+    if (n >= (uint64_t)(r->end - r->p)) {
+        r->err = true;
+        return NULL;
+    }
+
+    const char *s = get_bytes(r, n + 1);
+    if (s == NULL || s[n] != '\0') {
+        r->err = true;
+        return NULL;
+    }
+    return s;
+}
+
+static int frag_cmp(const void *a, const void *b)
+{
+    uint64_t key_a = ((const struct cache_frag *)a)->key;
+    uint64_t key_b = ((const struct cache_frag *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+bool cache_load_frags(uint64_t key, struct cache_frags *table)
+{
+    struct reader r;
+    *table = (struct cache_frags){ 0 };
+    if (key == 0 || !open_entry(&table->src, &r, key, &key, sizeof key, "zfrag",
+            FRAGS_MAGIC)) {
+        *table = (struct cache_frags){ 0 };
+        return false;
+    }
+
+    size_t max_frags = 0, n_helpers = 0, max_helpers = 0;
+    while (get_uint(&r) == 1 && !r.err) {
+        if (table->n_frags == max_frags) {
+            max_frags = max_frags ? max_frags * 2 : 256;
+            table->frags = realloc(table->frags,
+                    max_frags * sizeof *table->frags);
+        }
+
+        struct cache_frag *frag = &table->frags[table->n_frags++];
+        const void *frag_key = get_bytes(&r, sizeof frag->key);
+        if (frag_key == NULL)
+            break;
+        memcpy(&frag->key, frag_key, sizeof frag->key);
+        for (int i = 0; i < N_FRAG_TEXTS; ++i)
+            frag->texts[i] = get_text(&r);
+
+        frag->first_helper = n_helpers;
+        frag->n_helpers = get_uint(&r);
+        if (frag->n_helpers > (uint64_t)(r.end - r.p)) {
+            r.err = true;
+            break;
+        }
+
+        for (size_t i = 0; i < 3 * frag->n_helpers; ++i) {
+            if (n_helpers == max_helpers) {
+                max_helpers = max_helpers ? max_helpers * 2 : 256;
+                table->helpers = realloc(table->helpers,
+                        max_helpers * sizeof *table->helpers);
+            }
+            table->helpers[n_helpers++] = get_text(&r);
+        }
+    }
+
+    if (r.err || r.p != r.end) {
+        cache_free_frags(table);
+        return false;
+    }
+
+    qsort(table->frags, table->n_frags, sizeof *table->frags, frag_cmp);
+    return true;
+}
+
+void cache_free_frags(struct cache_frags *table)
+{
+    if (table->src.data != NULL)
+        lex_src_close(&table->src);
+    free(table->frags);
+    free(table->helpers);
+    *table = (struct cache_frags){ 0 };
+}
+
+struct cache_frag *cache_find_frag(struct cache_frags *table, uint64_t key)
+{
+    if (table->n_frags == 0)
+        return NULL;
+
+    struct cache_frag frag = { .key = key };
+    return bsearch(&frag, table->frags, table->n_frags, sizeof frag, frag_cmp);
+}
+
+void cache_count(enum cache_stat stat)
+{
+    stats[stat]++;
+}
+
+// Add the counts in the statistics file fp to counts.
+static void read_stats(FILE *fp, uint64_t counts[])
+{
+    char name[64];
+    unsigned long long n;
+
+    while (fscanf(fp, "%63s %llu", name, &n) == 2) {
+        for (int i = 0; i < N_CACHE_STATS; ++i) {
+            if (strcmp(name, stat_names[i]) == 0)
+                counts[i] += n;
+        }
+    }
+}
+
+void cache_save_stats(void)
+{
+    bool counted = false;
+    for (int i = 0; i < N_CACHE_STATS; ++i)
+        counted |= stats[i] != 0;
+
+    if (zc_cache_dir == NULL || !counted)
+        return;
+
+    char *path;
+    if (asprintf(&path, "%s/stats", zc_cache_dir) < 0)
+        return;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0 && errno == ENOENT) {
+        make_dirs(zc_cache_dir);
+        fd = open(path, O_RDWR | O_CREAT, 0666);
+    }
+    free(path);
+
+    FILE *fp;
+    if (fd < 0 || (fp = fdopen(fd, "r+")) == NULL)
+        return;
+
+    // The file is locked, as other processes can update it at the same time.
+    flock(fd, LOCK_EX);
+
+    uint64_t counts[N_CACHE_STATS] = { 0 };
+    read_stats(fp, counts);
+
+    rewind(fp);
+    if (ftruncate(fd, 0) == 0) {
+        for (int i = 0; i < N_CACHE_STATS; ++i)
+            fprintf(fp, "%s %llu\n", stat_names[i],
+                    (unsigned long long)(counts[i] + stats[i]));
+    }
+
+    // Closing the file releases the lock.
+    fclose(fp);
+}
+
+void cache_print_stats(void)
+{
+    if (zc_cache_dir == NULL) {
+        printf("cache disabled\n");
+        return;
+    }
+
+    uint64_t counts[N_CACHE_STATS] = { 0 };
+
+    char *path;
+    if (asprintf(&path, "%s/stats", zc_cache_dir) >= 0) {
+        FILE *fp = fopen(path, "r");
+        if (fp != NULL) {
+            read_stats(fp, counts);
+            fclose(fp);
+        }
+        free(path);
+    }
+
+    printf("%-28s %s\n", "cache directory", zc_cache_dir);
+    for (int i = 0; i < N_CACHE_STATS; ++i)
+        printf("%-28s %llu\n", stat_descs[i], (unsigned long long)counts[i]);
+}
@@ -0,0 +1,132 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+// On-disk cache of results which only depend on the content of files and the
+// compiler, like the AST of an included file or the object file for a source
+// file.  Entries are files in the cache directory, named by a key which is a
+// hash of the compiler and the content.
+
+// Digest of the input of a compile cache entry, which is SHA-256 over all of the
+// input, so different inputs do not share an entry.  The entry is named by the
+// start of the digest, and the whole digest is stored in it and compared when
+// it is loaded.  The cache is not used for a digest which is not valid.
+struct cache_digest {
+    bool valid;
+    unsigned char bytes[SHA256_SIZE];
+};
+
+// Statistics of the cache use, which are kept in the cache directory.
+enum cache_stat {
+    CACHE_SOURCE_HIT,   // Output found by the source file and its includes.
+    CACHE_C_HIT,        // Output found by the generated C code.
+    CACHE_MISS,         // Output compiled by GCC.
+    CACHE_INCLUDE_HIT,  // AST of an included file loaded.
+    CACHE_INCLUDE_MISS, // Included file parsed.
+    CACHE_FUNC_HIT,     // C code of a function reused.
+    CACHE_FUNC_MISS,    // C code of a function generated.
+    CACHE_SHARD_HIT,    // Object file of a shard found by its C code.
+    CACHE_SHARD_MISS,   // Shard compiled by GCC.
+    N_CACHE_STATS
+};
+
+// Continue the hash h with n bytes of data.
+uint64_t cache_hash(uint64_t h, const void *data, size_t n);
+
+// Continue the hash h with a string.
+uint64_t cache_hash_str(uint64_t h, const char *s);
+
+// Get the key of the cache entry for content of n bytes, or zero if the cache
+// cannot be used.
+uint64_t cache_key(const void *data, size_t n);
+
+// Continue the hash h with an AST.  The locations are not part of the hash.
+uint64_t cache_hash_ast(uint64_t h, struct ast *ast);
+
+// Get the start of the digest of a compile cache entry, which identifies the
+// compiler and GCC.  GCC is identified by its version and target and by the
+// cc1 it runs.  The digest is not valid if the cache cannot be used.
+struct cache_digest cache_compile_digest(void);
+
+// Continue a digest with a string, or with the content of a file.  The digest
+// of a file is not valid if it cannot be read.
+struct cache_digest cache_digest_str(struct cache_digest d, const char *s);
+struct cache_digest cache_digest_file(struct cache_digest d, const char *path);
+
+// Load the AST stored for key.  The locations in the AST are in the file with
+// index file.  Included files are represented by INCLUDE nodes with the path of
+// the file as a NAME child, which have to be replaced by the included AST.
+// Returns NULL if there is no valid entry for key.
+struct ast *cache_load_ast(uint64_t key, unsigned file);
+
+// Store the AST of a file for key.  includes are the INCLUDE nodes for the
+// files included by the file, in the order the SOURCE_FILE and ALREADY_INCLUDED
+// nodes of the includes appear in ast.
+void cache_store_ast(uint64_t key, struct ast *ast, struct ast **includes,
+        size_t n_includes);
+
+// Store and load the manifest of a source file, which maps the digest of the
+// source file to the digest of its output.  The manifest lists the files
+// included by the source file, and is only valid while they have the same
+// content.
+void cache_store_manifest(struct cache_digest key, struct include_dep *deps,
+        size_t n_deps, struct cache_digest result);
+bool cache_load_manifest(struct cache_digest key, struct cache_digest *result);
+
+// Get the digest of the output for the source file with digest key, which
+// depends on the files it includes.
+struct cache_digest cache_deps_digest(struct cache_digest key,
+        struct include_dep *deps, size_t n_deps);
+
+// Copy the file stored for key to path.  Returns false if there is no entry.
+bool cache_get_file(struct cache_digest key, const char *path);
+
+// Store a copy of the file at path for key.
+void cache_put_file(struct cache_digest key, const char *path);
+
+// Number of texts in the C code of a function: the declarations and
+// definitions of its structures, the declarations and definitions of its
+// helpers, and its definition.
+#define N_FRAG_TEXTS 5
+
+// C code generated for a function, kept in the fragment table of the source
+// file to be reused while the fingerprint of the function is the same.
+struct cache_frag {
+    uint64_t key;     // Fingerprint of the function.
+    const char *texts[N_FRAG_TEXTS];
+    size_t first_helper; // The shared helpers used by the function, as the
+    size_t n_helpers;    // name, declaration and definition of each.
+};
+
+// Fragment table loaded from the cache.  The strings are in the mapped entry.
+struct cache_frags {
+    struct cache_frag *frags; // Sorted by key.
+    size_t n_frags;
+    const char **helpers;
+    struct lex_src src;
+};
+
+// Load the fragment table stored for key.  Returns false if there is none.
+bool cache_load_frags(uint64_t key, struct cache_frags *table);
+void cache_free_frags(struct cache_frags *table);
+
+// Find the code of the function with fingerprint key in a table.
+struct cache_frag *cache_find_frag(struct cache_frags *table, uint64_t key);
+
+// Write a fragment table for key, one function at a time.  The table replaces
+// the stored one when it is closed with complete set.  Returns NULL if the
+// cache cannot be used.
+struct frag_writer *cache_open_frags(uint64_t key);
+void cache_put_frag(struct frag_writer *w, struct cache_frag *frag,
+        const char **helpers);
+void cache_close_frags(struct frag_writer *w, bool complete);
+
+// Count a use of the cache.
+void cache_count(enum cache_stat stat);
+
+// Add the counts of this process to the statistics in the cache directory.
+void cache_save_stats(void);
+
+// Print the statistics in the cache directory.
+void cache_print_stats(void);
+
+#endif // !defined CACHE_H
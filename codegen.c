@@ -1,20 +1,115 @@
 #include "zc.h"
 
 struct lbl {
-    char *name;
+    const char *name;
     char *c_name;
     bool defined;
     struct ast *first_use;
     struct lbl *next;
 };
 
+// A definition in the translation unit.  Functions are generated as jobs,
+// which can run in parallel.  The structures and helpers local to a function
+// are emitted with it, so the output does not depend on the order the
+// functions are generated in.
+struct func_job {
+    struct ast *ast;    // The function definition, or NULL for data.
+    struct rope *rope;  // The C code of the definition.
+
+    struct rope *type_decls_rope;
+    struct rope *type_defs_rope;
+    struct rope *prog_decls_rope;
+    struct rope *prog_defs_rope;
+
+    uint64_t key;       // Fingerprint of the function, or zero if not cached.
+    struct cache_frag *frag;            // Code reused from the cache, or NULL.
+    struct used_helper *used_helpers;   // Shared helpers used by the function.
+};
+
+// Shared helper used by a function, recorded so the helper can be emitted
+// with the function when its code is reused.
+struct used_helper {
+    const char *name;
+    struct used_helper *next;
+};
+
 // List of labels used so they can be checked against defined labels
-struct lbl *lbl_list = NULL;
+_Thread_local struct lbl *lbl_list;
+
+// The function generated by the thread, or NULL outside of functions.
+_Thread_local struct func_job *zc_job;
+
+// Number of identifiers generated in the current function, or in the
+// translation unit outside of functions.
+static _Thread_local int n_idents;
+
+// Set while functions are generated by more than one thread.
+static bool is_parallel;
+
+// Lock for the state shared by the threads generating functions which is
+// changed lazily: unresolved global symbols, structure layouts and indexes,
+// and alias caches and helpers.  It is recursive, as resolving a symbol or
+// expanding an alias can need more of them.
+static pthread_mutex_t globals_lock;
+static pthread_once_t globals_lock_once = PTHREAD_ONCE_INIT;
+
+static void init_globals_lock(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&globals_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void lock_globals(void)
+{
+    if (is_parallel)
+        pthread_mutex_lock(&globals_lock);
+}
+
+void unlock_globals(void)
+{
+    if (is_parallel)
+        pthread_mutex_unlock(&globals_lock);
+}
+
+// Helper function of a global alias.  The helpers are shared by all functions
+// and emitted sorted by name, as the order they are created in depends on the
+// order the functions are generated in.
+struct helper {
+    const char *name;
+    struct rope *decl;
+    struct rope *def;
+};
+
+static struct helper *helpers;
+static size_t n_helpers;
+static size_t max_helpers;
+
+// Declaration of a global symbol, kept so a shard can leave out the functions
+// it does not reference.
+struct global_decl {
+    struct decl_sym *decl;
+    struct rope *rope;
+};
+
+static struct global_decl *global_decls;
+static size_t n_global_decls;
+static size_t max_global_decls;
+
+// Set while the types of a shared helper are added.
+static _Thread_local bool in_shared_helper;
+
+// Set if the code of a function depends on a structure another function, or
+// the translation unit, has to define.  The code of the functions can then not
+// be reused one at a time.
+static bool has_shared_local_types;
 
 struct lbl *new_lbl(const char *name, bool defined)
 {
     struct lbl *lbl = malloc(sizeof *lbl);
-    lbl->name = strdup(name);
+    lbl->name = name;
     lbl->c_name = gen_c_ident();
     lbl->defined = defined;
     lbl->next = lbl_list;
@@ -33,8 +128,6 @@ void check_lbl_list(struct lbl *lbl_node)
     if (!lbl_node->defined)
         fatal(lbl_node->first_use->loc, "undefined label %s", lbl_node->name);
 
-    free(lbl_node->name);
-    free(lbl_node->c_name);
     check_lbl_list(lbl_node->next);
     free(lbl_node);
 }
@@ -70,12 +163,12 @@ const char *define_label(const char *name)
 
 void push_scope(void)
 {
-    current_scope = scope_new(current_scope, 256, 16);
+    scope_push(current_scope);
 }
 
 void pop_scope(void)
 {
-    current_scope = current_scope->parent;
+    scope_pop(current_scope);
 }
 
 inline static struct rope *add_paren(struct rope *rope)
@@ -535,7 +628,7 @@ struct rope *block_to_c(struct ast *ast)
 
 struct rope *func_body_to_c(struct ast *ast)
 {
-    zc_func_labels = strmap_new(32);
+    zc_func_labels = strmap_new(0);
     lbl_list = NULL;
 
     struct rope *rope = lcurly_nl_rope;
@@ -571,6 +664,13 @@ void add_global_decl(struct decl_sym *decl)
     rope = rope_new_tree(extern_sp_rope, rope);
     rope = rope_new_tree(rope, semi_nl_rope);
     zc_prog_decls_rope = rope_new_tree(zc_prog_decls_rope, rope);
+
+    if (n_global_decls == max_global_decls) {
+        max_global_decls = max_global_decls == 0 ? 64 : max_global_decls * 2;
+        global_decls = realloc(global_decls,
+                max_global_decls * sizeof *global_decls);
+    }
+    global_decls[n_global_decls++] = (struct global_decl){ decl, rope };
 }
 
 void add_local_decl(struct decl_sym *decl)
@@ -596,21 +696,46 @@ void add_local_decl(struct decl_sym *decl)
 
 void add_struct_def(struct struct_type *type)
 {
+    if (type->job != NULL && (type->job != zc_job || in_shared_helper))
+        __atomic_store_n(&has_shared_local_types, true, __ATOMIC_RELAXED);
+
     if (type->is_defined)
         return;
+
+    // Global structures are defined before the functions are generated, but
+    // one missed could be defined by several threads.
+    lock_globals();
+    if (type->is_defined) {
+        unlock_globals();
+        return;
+    }
     type->is_defined = true;
-    
+    if (zc_job != NULL && type->job == NULL)
+        has_shared_local_types = true;
+
+    // The definition is part of the translation unit even if the structure
+    // is local to the function being generated, but it is emitted with the
+    // function so the output does not depend on the order they are generated.
+    struct arena *arena = zc_arena;
+    zc_arena = &zc_tu_arena;
+
     for (size_t i = 0; i < type->n_fields; i++)
         add_type_decl(type->fields[i].type);
 
+    struct rope **decls = zc_job ? &zc_job->type_decls_rope : &zc_type_decls_rope;
+    struct rope **defs = zc_job ? &zc_job->type_defs_rope : &zc_type_defs_rope;
+
     struct rope *rope = NULL;
     rope = struct_def_to_c(type);
     rope = rope_new_tree(rope, semi_nl_rope);
-    zc_type_defs_rope = rope_new_tree(zc_type_defs_rope, rope);
+    *defs = rope_new_tree(*defs, rope);
 
     rope = struct_type_to_c(NULL, type);
     rope = rope_new_tree(rope, semi_nl_rope);
-    zc_type_decls_rope = rope_new_tree(zc_type_decls_rope, rope);
+    *decls = rope_new_tree(*decls, rope);
+
+    zc_arena = arena;
+    unlock_globals();
 }
 
 void add_type_decl(struct type *type)
@@ -631,6 +756,73 @@ void add_type_decl(struct type *type)
     }
 }
 
+static void push_helper(const char *name, struct rope *decl, struct rope *def)
+{
+    if (n_helpers == max_helpers) {
+        max_helpers = max_helpers == 0 ? 16 : max_helpers * 2;
+        helpers = realloc(helpers, max_helpers * sizeof *helpers);
+    }
+    helpers[n_helpers++] = (struct helper){ name, decl, def };
+}
+
+void use_expr_helper(const char *name)
+{
+    if (zc_job == NULL)
+        return;
+
+    struct used_helper **tail = &zc_job->used_helpers;
+    for (; *tail != NULL; tail = &(*tail)->next) {
+        if (strcmp((*tail)->name, name) == 0)
+            return;
+    }
+
+    *tail = arena_alloc(&zc_tu_arena, sizeof **tail);
+    **tail = (struct used_helper){ name, NULL };
+}
+
+// Emit a function which returns the value of an expression, and get its name.
+// The expression can only reference global symbols.  A helper with a name is
+// shared by all functions, and one without a name is local to the function
+// generated and gets a generated name.
+const char *add_expr_helper(struct expr expr, const char *name)
+{
+    struct arena *arena = zc_arena;
+    zc_arena = &zc_tu_arena;
+
+    bool is_shared = name != NULL;
+    if (!is_shared)
+        name = gen_c_global_ident();
+
+    in_shared_helper = is_shared;
+    add_type_decl(expr.type);
+    in_shared_helper = false;
+
+    struct rope *decl = rope_new_fmt("%s(void)", name);
+    decl = rope_new_tree(static_inline_sp_rope, type_to_c(decl, expr.type));
+
+    struct rope *rope = rope_new_tree(nl_rope, decl);
+    rope = rope_new_tree(rope, sp_rope);
+    rope = rope_new_tree(rope, lcurly_nl_rope);
+    rope = rope_new_tree(rope, indent_rope);
+    rope = rope_new_tree(rope, return_sp_rope);
+    rope = rope_new_tree(rope, rope_flatten(expr.rope));
+    rope = rope_new_tree(rope, semi_nl_rope);
+    rope = rope_new_tree(rope, rcurly_nl_rope);
+
+    decl = rope_new_tree(decl, semi_nl_rope);
+
+    if (is_shared) {
+        push_helper(name, decl, rope);
+        use_expr_helper(name);
+    } else {
+        zc_job->prog_decls_rope = rope_new_tree(zc_job->prog_decls_rope, decl);
+        zc_job->prog_defs_rope = rope_new_tree(zc_job->prog_defs_rope, rope);
+    }
+
+    zc_arena = arena;
+    return name;
+}
+
 struct rope *func_def_to_c(struct ast *ast)
 {
     struct ast *decl_ast = ast_ast(ast, 0);
@@ -716,7 +908,7 @@ struct rope *data_def_to_c(struct ast *ast)
     struct ast *init_ast = ast_ast(ast, 1);
     const char *name = ast_s(ast_ast(decl_ast, 0));
 
-    struct sym *sym = scope_get_sym(global_scope, name);
+    struct sym *sym = scope_get_global_sym(current_scope, name);
     assert(sym->tag == DECL_SYM);
     struct decl_sym *decl = (struct decl_sym *)sym;
 
@@ -730,11 +922,6 @@ struct rope *data_def_to_c(struct ast *ast)
     return rope;
 }
 
-void append_def(struct rope *rope)
-{
-    zc_prog_defs_rope = rope_new_tree(zc_prog_defs_rope, rope);
-}
-
 void decl_pass(struct ast *ast)
 {
     size_t n_extern_defs;
@@ -816,7 +1003,52 @@ void decl_pass(struct ast *ast)
     }
 }
 
-void codegen_pass(struct ast *ast)
+// The definitions of the translation unit, in the order they are emitted.
+struct job_list {
+    struct func_job *jobs;
+    size_t n_jobs;
+    size_t max_jobs;
+
+    size_t next_job;            // Next job to be taken by a worker thread.
+    struct scope *scope;        // The global symbols.
+
+    // Translation unit arenas of the worker threads.
+    struct arena *tu_arenas;
+    size_t n_tu_arenas;
+
+    // Fragment table of the source file, and the one written for the next
+    // build if the functions generated differ from it.  The fingerprints of
+    // the functions continue the hash frags_context.
+    uint64_t frags_key;
+    uint64_t frags_context;
+    struct cache_frags frags;
+    struct frag_writer *frag_writer;
+    bool is_frags_changed;
+
+    // Index plus one of the helpers by name, as atoms, covering the first
+    // n_indexed_helpers helpers.
+    struct strmap *helper_index;
+    size_t n_indexed_helpers;
+};
+
+static struct func_job *new_job(struct job_list *list, struct ast *ast)
+{
+    if (list->n_jobs == list->max_jobs) {
+        list->max_jobs = list->max_jobs == 0 ? 64 : list->max_jobs * 2;
+        list->jobs = realloc(list->jobs, list->max_jobs * sizeof *list->jobs);
+    }
+
+    struct func_job *job = &list->jobs[list->n_jobs];
+    memset(job, 0, sizeof *job);
+    job->ast = ast;
+    list->n_jobs++;
+    return job;
+}
+
+// Resolve the global symbols in the order they are declared, so the functions
+// can be generated in parallel without resolving symbols, and the declarations
+// are emitted in the same order for any number of threads.
+void codegen_pass(struct ast *ast, struct job_list *list)
 {
     size_t n_extern_defs;
     struct ast **extern_defs = ast_asts(ast, &n_extern_defs);
@@ -826,66 +1058,805 @@ void codegen_pass(struct ast *ast)
 
         switch (extern_def->tag) {
             case ASGN_EXPR:
-                append_def(data_def_to_c(extern_def));
+                new_job(list, NULL)->rope = data_def_to_c(extern_def);
                 break;
-            case FUNC_DEF:
-                append_def(func_def_to_c(extern_def));
+            case FUNC_DEF: {
+                struct ast *decl_ast = ast_ast(extern_def, 0);
+                scope_get_sym(current_scope, ast_s(ast_ast(decl_ast, 0)));
+                new_job(list, extern_def);
                 break;
+            }
             case TYPE_DEF: {
                 scope_get_type(current_scope, ast_s(ast_ast(extern_def, 0)));
                 continue;
             }
+            case DECL:
+            case ALIAS_DEF:
+                scope_get_sym(current_scope, ast_s(ast_ast(extern_def, 0)));
+                continue;
             case SOURCE_FILE:
-                codegen_pass(extern_def);
+                codegen_pass(extern_def, list);
         }
     }
 }
 
+// Generate a function in the function arena, and keep only its C text once
+// it has been generated.
+static void run_job(struct func_job *job)
+{
+    zc_job = job;
+    n_idents = 0;
+
+    zc_arena = &zc_func_arena;
+    struct rope *rope = func_def_to_c(job->ast);
+    zc_arena = &zc_tu_arena;
+
+    job->rope = rope_flatten(rope);
+    arena_reset(&zc_func_arena);
+    zc_job = NULL;
+}
+
+// Take jobs from the list until all have been taken.
+static void run_jobs(struct job_list *list)
+{
+    size_t i;
+    while ((i = __atomic_fetch_add(&list->next_job, 1, __ATOMIC_RELAXED)) <
+            list->n_jobs) {
+        if (list->jobs[i].ast != NULL && list->jobs[i].frag == NULL)
+            run_job(&list->jobs[i]);
+    }
+}
+
+// Start routine of a worker thread.  Its translation unit arena has objects
+// which are part of the output, so it is handed over to be freed once the
+// output has been written.
+static void *worker_main(void *arg)
+{
+    struct job_list *list = arg;
+
+    zc_arena = &zc_tu_arena;
+    current_scope = scope_copy(list->scope);
+
+    run_jobs(list);
+
+    scope_del(current_scope);
+    current_scope = NULL;
+    arena_free(&zc_func_arena);
+    return memcpy(malloc(sizeof zc_tu_arena), &zc_tu_arena, sizeof zc_tu_arena);
+}
+
+// Generate the functions with zc_n_jobs threads.
+static void gen_funcs(struct job_list *list)
+{
+    size_t n_funcs = 0;
+    for (size_t i = 0; i < list->n_jobs; i++)
+        n_funcs += list->jobs[i].ast != NULL && list->jobs[i].frag == NULL;
+
+    size_t n_threads = zc_n_jobs < n_funcs ? zc_n_jobs : n_funcs;
+    list->next_job = 0;
+    list->scope = current_scope;
+
+    if (n_threads <= 1) {
+        run_jobs(list);
+        return;
+    }
+
+    pthread_t threads[n_threads];
+    pthread_once(&globals_lock_once, init_globals_lock);
+    is_parallel = true;
+
+    for (size_t i = 0; i < n_threads; i++) {
+        int err = pthread_create(&threads[i], NULL, worker_main, list);
+        if (err != 0)
+            fatal(NO_LOC, "cannot create thread: %s", strerror(err));
+    }
+
+    list->tu_arenas = malloc(n_threads * sizeof *list->tu_arenas);
+    list->n_tu_arenas = n_threads;
+    for (size_t i = 0; i < n_threads; i++) {
+        void *arena;
+        pthread_join(threads[i], &arena);
+        list->tu_arenas[i] = *(struct arena *)arena;
+        free(arena);
+    }
+
+    is_parallel = false;
+}
+
+// Get the key of the fragment table of the source files of ast, or zero.  The
+// AST of several source files has them as children.
+static uint64_t frags_key(struct ast *ast)
+{
+    size_t n_files = 1;
+    struct ast **files = &ast;
+    if (ast->loc == NO_LOC)
+        files = ast_asts(ast, &n_files);
+
+    uint64_t key = cache_key(NULL, 0);
+    for (size_t i = 0; i < n_files && key != 0; i++) {
+        char *real_path = realpath(loc_path(files[i]->loc), NULL);
+        if (real_path == NULL)
+            return 0;
+
+        key = cache_hash_str(key, real_path);
+        free(real_path);
+    }
+
+    return key;
+}
+
+// Continue the hash h with the top level of a translation unit, leaving out
+// the function definitions.
+static uint64_t hash_decls(uint64_t h, struct ast *ast)
+{
+    size_t n_childs;
+    struct ast **childs = ast_asts(ast, &n_childs);
+
+    for (size_t i = 0; i < n_childs; i++) {
+        if (childs[i]->tag == SOURCE_FILE)
+            h = hash_decls(h, childs[i]);
+        else if (childs[i]->tag != FUNC_DEF)
+            h = cache_hash_ast(h, childs[i]);
+    }
+
+    return h;
+}
+
+// Find the global functions named in ast, also through the aliases it uses.
+// The aliases walked are put in aliases, and the functions in funcs, both by
+// name.  Returns the hash h continued with the declarations of the functions
+// which were not already in funcs.
+static uint64_t walk_func_refs(uint64_t h, struct ast *ast,
+        struct strmap *aliases, struct strmap *funcs)
+{
+    if (ast == NULL)
+        return h;
+
+    if (ast->tag == NAME) {
+        const char *name = ast_s(ast);
+        struct sym *sym = scope_get_global_sym(current_scope, name);
+
+        if (sym != NULL && sym->tag == DECL_SYM) {
+            struct type *type = ((struct decl_sym *)sym)->type;
+            if (type != NULL && is_func_type(type) &&
+                    strmap_get(funcs, name) == NULL) {
+                strmap_add(funcs, name, sym);
+                h = cache_hash_ast(h, sym->loc);
+            }
+        } else if (sym != NULL && sym->tag == ALIAS_SYM &&
+                strmap_get(aliases, name) == NULL) {
+            strmap_add(aliases, name, sym);
+            h = walk_func_refs(h, ((struct alias_sym *)sym)->ast, aliases,
+                    funcs);
+        }
+        return h;
+    }
+
+    if (!ast_has_ast(ast->tag))
+        return h;
+
+    size_t n_childs;
+    struct ast **childs = ast_asts(ast, &n_childs);
+    for (size_t i = 0; i < n_childs; i++)
+        h = walk_func_refs(h, childs[i], aliases, funcs);
+    return h;
+}
+
+static struct rope *text_rope(const char *s)
+{
+    return s[0] != '\0' ? rope_new_s(s) : NULL;
+}
+
+// Get the text of a rope, flattened in the current arena.
+static const char *rope_text(struct rope *rope)
+{
+    if (rope == NULL)
+        return NULL;
+    return rope->leaf ? rope->val.s : rope_flatten(rope)->val.s;
+}
+
+// Add the shared helpers used by a function with reused code to the helpers,
+// which are kept in the translation unit arena.
+static void add_frag_helpers(struct job_list *list, struct func_job *job)
+{
+    struct arena *arena = zc_arena;
+    zc_arena = &zc_tu_arena;
+
+    const char **texts = list->frags.helpers + job->frag->first_helper;
+    for (size_t i = 0; i < job->frag->n_helpers; i++, texts += 3)
+        push_helper(texts[0], text_rope(texts[1]), text_rope(texts[2]));
+
+    zc_arena = arena;
+}
+
+// Get the text of a helper, which is flattened in the translation unit arena
+// the first time.
+static const char *helper_text(struct rope **rope)
+{
+    if (!(*rope)->leaf) {
+        struct arena *arena = zc_arena;
+        zc_arena = &zc_tu_arena;
+        *rope = rope_flatten(*rope);
+        zc_arena = arena;
+    }
+    return (*rope)->val.s;
+}
+
+// Find the shared helper with a name, which has to be an atom.  Returns NULL
+// if there is none.
+static struct helper *find_helper(struct job_list *list, const char *name)
+{
+    if (list->helper_index == NULL)
+        list->helper_index = strmap_new(0);
+
+    for (; list->n_indexed_helpers < n_helpers; list->n_indexed_helpers++) {
+        size_t i = list->n_indexed_helpers;
+        const char *s = atom_new(helpers[i].name);
+        if (strmap_get(list->helper_index, s) == NULL)
+            strmap_add(list->helper_index, s, (void *)(i + 1));
+    }
+
+    size_t i = (size_t)strmap_get(list->helper_index, name);
+    return i != 0 ? &helpers[i - 1] : NULL;
+}
+
+// Set of shared helpers.
+struct helper_set {
+    struct strmap *names; // The helpers by name, as atoms.
+    struct helper **helpers;
+    size_t n_helpers;
+    size_t max_helpers;
+};
+
+// Add a shared helper to a set, after the helpers it calls, which are found
+// by their names in its definition.  This is the order the helpers are created
+// in, as a helper is created once the helpers it calls have been.
+static void add_to_helper_set(struct job_list *list, struct helper_set *set,
+        const char *name)
+{
+    struct helper *helper = find_helper(list, name);
+    if (helper == NULL || strmap_get(set->names, name) != NULL)
+        return;
+    strmap_add(set->names, name, helper);
+
+    const char *def = helper_text(&helper->def);
+    for (const char *p = def; (p = strstr(p, "id_")) != NULL; ) {
+        size_t n = strspn(p, "abcdefghijklmnopqrstuvwxyz"
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+        if (p == def || !(isalnum((unsigned char)p[-1]) || p[-1] == '_'))
+            add_to_helper_set(list, set, atom_new_n(p, n));
+        p += n;
+    }
+
+    if (set->n_helpers == set->max_helpers) {
+        set->max_helpers = set->max_helpers ? set->max_helpers * 2 : 8;
+        set->helpers = realloc(set->helpers,
+                set->max_helpers * sizeof *set->helpers);
+    }
+    set->helpers[set->n_helpers++] = helper;
+}
+
+// Add the shared helpers used by a function to a set.  A function only records
+// the helpers it calls itself, so the helpers called by them are added too.
+static void add_job_helpers(struct job_list *list, struct helper_set *set,
+        struct func_job *job)
+{
+    if (job->frag != NULL) {
+        const char **texts = list->frags.helpers + job->frag->first_helper;
+        for (size_t i = 0; i < job->frag->n_helpers; i++)
+            add_to_helper_set(list, set, atom_new(texts[3 * i]));
+    }
+
+    for (struct used_helper *u = job->used_helpers; u != NULL; u = u->next)
+        add_to_helper_set(list, set, atom_new(u->name));
+}
+
+// Write the code of a function to the fragment table.
+static void put_job_frag(struct job_list *list, struct func_job *job)
+{
+    if (list->frag_writer == NULL || job->key == 0)
+        return;
+
+    if (job->frag != NULL) {
+        cache_put_frag(list->frag_writer, job->frag,
+                list->frags.helpers + job->frag->first_helper);
+        return;
+    }
+
+    struct cache_frag frag = {
+        .key = job->key,
+        .texts = {
+            rope_text(job->type_decls_rope),
+            rope_text(job->type_defs_rope),
+            rope_text(job->prog_decls_rope),
+            rope_text(job->prog_defs_rope),
+            rope_text(job->rope),
+        },
+    };
+
+    struct helper_set set = { .names = strmap_new(0) };
+    add_job_helpers(list, &set, job);
+    frag.n_helpers = set.n_helpers;
+
+    const char *texts[3 * set.n_helpers + 1];
+    for (size_t i = 0; i < set.n_helpers; i++) {
+        texts[3 * i] = set.helpers[i]->name;
+        texts[3 * i + 1] = helper_text(&set.helpers[i]->decl);
+        texts[3 * i + 2] = helper_text(&set.helpers[i]->def);
+    }
+
+    cache_put_frag(list->frag_writer, &frag, texts);
+    strmap_del(set.names, NULL);
+    free(set.helpers);
+}
+
+// Compute the fingerprint of a function with the AST ast, and take its code if
+// it is found in the fragment table.  Returns whether it was found.
+static bool find_frag(struct job_list *list, struct func_job *job,
+        struct ast *ast)
+{
+    struct strmap *aliases = strmap_new(0);
+    struct strmap *funcs = strmap_new(0);
+    job->key = cache_hash_ast(list->frags_context, ast);
+    job->key = walk_func_refs(job->key, ast, aliases, funcs);
+    strmap_del(aliases, NULL);
+    strmap_del(funcs, NULL);
+    if (job->key == 0)
+        job->key = 1;
+
+    struct cache_frag *frag = cache_find_frag(&list->frags, job->key);
+    if (frag == NULL) {
+        cache_count(CACHE_FUNC_MISS);
+        return false;
+    }
+
+    cache_count(CACHE_FUNC_HIT);
+    job->frag = frag;
+    job->type_decls_rope = text_rope(frag->texts[0]);
+    job->type_defs_rope = text_rope(frag->texts[1]);
+    job->prog_decls_rope = text_rope(frag->texts[2]);
+    job->prog_defs_rope = text_rope(frag->texts[3]);
+    job->rope = text_rope(frag->texts[4]);
+    return true;
+}
+
+// Open the fragment table for writing, as it has changed, and write the first
+// n jobs to it.  Their code has to have been reused.
+static void open_frag_writer(struct job_list *list, size_t n)
+{
+    list->is_frags_changed = true;
+    list->frag_writer = cache_open_frags(list->frags_key);
+    for (size_t i = 0; i < n; i++)
+        put_job_frag(list, &list->jobs[i]);
+}
+
+// Compute the fingerprints of the functions, and take the code of those found
+// in the fragment table of the source file.  A fingerprint covers the AST of
+// the function and everything else its code depends on: the declarations of
+// the functions it references, and the other declarations of the translation
+// unit with the C code generated for their types.  The functions with lazy
+// bodies are looked up by stream_jobs() once they have been parsed.
+static void reuse_frags(struct job_list *list, struct ast *ast)
+{
+    list->frags_key = frags_key(ast);
+    if (list->frags_key == 0)
+        return;
+
+    struct rope *rope = rope_new_tree(zc_type_decls_rope, zc_type_defs_rope);
+    rope = rope_new_tree(rope, zc_prog_defs_rope);
+    const char *s = rope_text(rope);
+    list->frags_context =
+        hash_decls(cache_key(s, s != NULL ? strlen(s) : 0), ast);
+
+    cache_load_frags(list->frags_key, &list->frags);
+    size_t n_funcs = 0, n_reused = 0, n_lazy = 0;
+
+    for (size_t i = 0; i < list->n_jobs; i++) {
+        struct func_job *job = &list->jobs[i];
+        if (job->ast == NULL)
+            continue;
+
+        n_funcs++;
+        if (ast_ast(job->ast, 1)->tag == LAZY_BLOCK)
+            n_lazy++;
+        else
+            n_reused += find_frag(list, job, job->ast);
+    }
+
+    // The table is only written again if it has changed.
+    if (n_reused + n_lazy < n_funcs ||
+            (n_lazy == 0 && list->frags.n_frags != n_funcs))
+        open_frag_writer(list, 0);
+}
+
+static int helper_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct helper *)a)->name,
+            ((const struct helper *)b)->name);
+}
+
+// Put the code generated for the definitions in the output ropes, in the order
+// of the definitions.
+static void emit_jobs(struct job_list *list)
+{
+    for (size_t i = 0; i < list->n_jobs; i++) {
+        struct func_job *job = &list->jobs[i];
+        zc_type_decls_rope = rope_new_tree(zc_type_decls_rope,
+                job->type_decls_rope);
+        zc_type_defs_rope = rope_new_tree(zc_type_defs_rope,
+                job->type_defs_rope);
+    }
+
+    // Helpers with the same name were created for wanted types with the same
+    // C type, and are emitted once.
+    if (n_helpers > 0)
+        qsort(helpers, n_helpers, sizeof *helpers, helper_cmp);
+    struct rope *helper_defs_rope = NULL;
+
+    for (size_t i = 0; i < n_helpers; i++) {
+        if (i > 0 && strcmp(helpers[i].name, helpers[i - 1].name) == 0)
+            continue;
+
+        zc_prog_decls_rope = rope_new_tree(zc_prog_decls_rope, helpers[i].decl);
+        helper_defs_rope = rope_new_tree(helper_defs_rope, helpers[i].def);
+    }
+
+    for (size_t i = 0; i < list->n_jobs; i++) {
+        struct func_job *job = &list->jobs[i];
+        zc_prog_decls_rope = rope_new_tree(zc_prog_decls_rope,
+                job->prog_decls_rope);
+        zc_prog_defs_rope = rope_new_tree(zc_prog_defs_rope,
+                job->prog_defs_rope);
+        zc_prog_defs_rope = rope_new_tree(zc_prog_defs_rope, job->rope);
+    }
+
+    zc_prog_defs_rope = rope_new_tree(zc_prog_defs_rope, helper_defs_rope);
+}
+
+// Generate the definitions one at a time, and write each to fp as soon as it
+// has been generated, so only the declarations are kept for the whole
+// translation unit.  The global declarations and types are written first.  The
+// structures, helpers and global declarations created for a function are
+// written before it.
+static void stream_jobs(struct job_list *list, FILE *fp)
+{
+    struct rope *rope = zc_type_decls_rope;
+    rope = rope_new_tree(rope, zc_type_defs_rope);
+    rope = rope_new_tree(rope, zc_prog_decls_rope);
+    rope = rope_new_tree(rope, zc_prog_defs_rope);
+    rope_print_to_file(rope, fp);
+    zc_type_decls_rope = NULL;
+    zc_type_defs_rope = NULL;
+    zc_prog_decls_rope = NULL;
+    zc_prog_defs_rope = NULL;
+
+    // Names of the shared helpers written, as atoms.
+    struct strmap *helper_names = strmap_new(0);
+    size_t n_written_helpers = 0;
+    size_t n_funcs = 0;
+
+    for (size_t i = 0; i < list->n_jobs; i++) {
+        struct func_job *job = &list->jobs[i];
+        struct ast *ast = job->ast;
+        n_funcs += ast != NULL;
+
+        // A lazy body is parsed in the function arena, so its AST is freed
+        // once the function has been written.
+        zc_arena = &zc_func_arena;
+        if (ast != NULL && ast_ast(ast, 1)->tag == LAZY_BLOCK) {
+            ast = ast_new_ast(ast->loc, FUNC_DEF, 2, ast_ast(ast, 0),
+                    parse_lazy_block(ast_ast(ast, 1)));
+            if (list->frags_key != 0 && !find_frag(list, job, ast) &&
+                    !list->is_frags_changed)
+                open_frag_writer(list, i);
+        }
+
+        if (ast != NULL && job->frag == NULL) {
+            zc_job = job;
+            n_idents = 0;
+            job->rope = func_def_to_c(ast);
+            zc_job = NULL;
+        }
+
+        if (job->frag != NULL)
+            add_frag_helpers(list, job);
+        rope = rope_new_tree(zc_type_decls_rope, zc_type_defs_rope);
+        rope = rope_new_tree(rope, job->type_decls_rope);
+        rope = rope_new_tree(rope, job->type_defs_rope);
+
+        for (; n_written_helpers < n_helpers; n_written_helpers++) {
+            struct helper *helper = &helpers[n_written_helpers];
+            const char *name = atom_new(helper->name);
+            if (strmap_get(helper_names, name) != NULL)
+                continue;
+
+            strmap_add(helper_names, name, helper);
+            rope = rope_new_tree(rope, helper->decl);
+            rope = rope_new_tree(rope, helper->def);
+        }
+
+        rope = rope_new_tree(rope, zc_prog_decls_rope);
+        rope = rope_new_tree(rope, zc_prog_defs_rope);
+        rope = rope_new_tree(rope, job->prog_decls_rope);
+        rope = rope_new_tree(rope, job->prog_defs_rope);
+        rope = rope_new_tree(rope, job->rope);
+        rope_print_to_file(rope, fp);
+        put_job_frag(list, job);
+        zc_type_decls_rope = NULL;
+        zc_type_defs_rope = NULL;
+        zc_prog_decls_rope = NULL;
+        zc_prog_defs_rope = NULL;
+
+        job->rope = NULL;
+        arena_reset(&zc_func_arena);
+        zc_arena = &zc_tu_arena;
+    }
+
+    // The table is written again without the functions which were removed.
+    if (list->frags_key != 0 && !list->is_frags_changed &&
+            list->frags.n_frags != n_funcs)
+        open_frag_writer(list, list->n_jobs);
+
+    strmap_del(helper_names, NULL);
+}
+
+// Functions are split in shards at the functions whose name hash is a
+// multiple of the shard size, so adding or removing a function only changes
+// the shards around it.  The size is a power of two giving about N_SHARDS
+// shards, which only changes when the number of functions doubles.
+#define N_SHARDS 16
+#define MIN_SHARD_SIZE 64
+
+static size_t get_shard_size(struct job_list *list)
+{
+    size_t n_funcs = 0;
+    for (size_t i = 0; i < list->n_jobs; i++)
+        n_funcs += list->jobs[i].ast != NULL;
+
+    size_t size = MIN_SHARD_SIZE;
+    while (size * N_SHARDS < n_funcs)
+        size *= 2;
+    return size;
+}
+
+static bool starts_shard(struct func_job *job, size_t size)
+{
+    if (job->ast == NULL)
+        return false;
+
+    const char *name = ast_s(ast_ast(ast_ast(job->ast, 0), 0));
+    return (cache_hash_str(14695981039346656037ULL, name) & (size - 1)) == 0;
+}
+
+// Write the shard with the functions from index first up to end.  The shard
+// has all global declarations and types, and the shared helpers used by its
+// functions.  The data definitions are all in the shard with has_data set.
+static void write_shard(struct job_list *list, FILE *fp, struct rope *prologue,
+        size_t first, size_t end, bool has_data)
+{
+    struct helper_set set = { .names = strmap_new(0) };
+    struct rope *type_decls = NULL;
+    struct rope *type_defs = NULL;
+    struct rope *defs = NULL;
+
+    for (size_t i = 0; i < list->n_jobs; i++) {
+        struct func_job *job = &list->jobs[i];
+        if (job->ast == NULL ? !has_data : i < first || i >= end)
+            continue;
+
+        type_decls = rope_new_tree(type_decls, job->type_decls_rope);
+        type_defs = rope_new_tree(type_defs, job->type_defs_rope);
+        add_job_helpers(list, &set, job);
+
+        defs = rope_new_tree(defs, job->prog_decls_rope);
+        defs = rope_new_tree(defs, job->prog_defs_rope);
+        defs = rope_new_tree(defs, job->rope);
+    }
+
+    struct rope *rope = rope_new_tree(prologue, type_decls);
+    rope = rope_new_tree(rope, type_defs);
+    for (size_t i = 0; i < set.n_helpers; i++)
+        rope = rope_new_tree(rope, set.helpers[i]->decl);
+    rope = rope_new_tree(rope, defs);
+    for (size_t i = 0; i < set.n_helpers; i++)
+        rope = rope_new_tree(rope, set.helpers[i]->def);
+    rope_print_to_file(rope, fp);
+
+    strmap_del(set.names, NULL);
+    free(set.helpers);
+}
+
+// Get the global declarations for the functions from index first up to end,
+// which leave out the functions they do not reference.
+static struct rope *shard_decls(struct job_list *list, size_t first,
+        size_t end)
+{
+    struct strmap *aliases = strmap_new(0);
+    struct strmap *funcs = strmap_new(0);
+    for (size_t i = first; i < end; i++) {
+        if (list->jobs[i].ast != NULL)
+            walk_func_refs(0, list->jobs[i].ast, aliases, funcs);
+    }
+
+    struct rope *rope = NULL;
+    for (size_t i = 0; i < n_global_decls; i++) {
+        struct decl_sym *decl = global_decls[i].decl;
+        const char *name = ast_s(ast_ast(decl->sym.loc, 0));
+        if (!is_func_type(decl->type) || strmap_get(funcs, name) != NULL)
+            rope = rope_new_tree(rope, global_decls[i].rope);
+    }
+
+    strmap_del(aliases, NULL);
+    strmap_del(funcs, NULL);
+    return rope;
+}
+
+// Write the definitions split in shards which can be compiled separately, and
+// get the number of shards.  Shard 0 is written to fp, and shard i to the file
+// <prefix>.<i>.c.  Shard 0 has the data definitions, which can reference any
+// function, so it declares all functions.
+static size_t write_shards(struct job_list *list, FILE *fp, const char *prefix)
+{
+    size_t size = get_shard_size(list);
+    size_t n_shards = 1;
+    for (size_t i = 1; i < list->n_jobs; i++)
+        n_shards += starts_shard(&list->jobs[i], size);
+    if (n_shards == 1)
+        return 1;
+
+    struct rope *types = rope_new_tree(zc_type_decls_rope, zc_type_defs_rope);
+
+    size_t first = 0;
+    for (size_t shard = 0; shard < n_shards; shard++) {
+        size_t end = first + 1;
+        while (end < list->n_jobs && !starts_shard(&list->jobs[end], size))
+            end++;
+
+        struct rope *decls = shard == 0 ? zc_prog_decls_rope :
+            shard_decls(list, first, end);
+        struct rope *prologue = rope_new_tree(types, decls);
+        prologue = rope_new_tree(prologue, zc_prog_defs_rope);
+
+        if (shard == 0) {
+            write_shard(list, fp, prologue, first, end, true);
+        } else {
+            char *path;
+            if (asprintf(&path, "%s.%zu.c", prefix, shard) < 0) {
+                perror("asprintf");
+                exit(1);
+            }
+
+            FILE *shard_fp = fopen(path, "w");
+            if (shard_fp == NULL)
+                fatal(NO_LOC, "cannot write %s: %s", path, strerror(errno));
+            write_shard(list, shard_fp, prologue, first, end, false);
+            fclose(shard_fp);
+            free(path);
+        }
+
+        first = end;
+    }
+
+    return n_shards;
+}
+
 void codegen_to_file(struct ast *ast, FILE *fp)
 {
-    struct scope *predecl_symtbl = scope_new(NULL, 1, 64);
-
-    scope_add_typesym(predecl_symtbl, "int", sym_new_type(int_type));
-    scope_add_typesym(predecl_symtbl, "int8", sym_new_type(int8_type));
-    scope_add_typesym(predecl_symtbl, "int16", sym_new_type(int16_type));
-    scope_add_typesym(predecl_symtbl, "int32", sym_new_type(int32_type));
-    scope_add_typesym(predecl_symtbl, "int64", sym_new_type(int64_type));
-    scope_add_typesym(predecl_symtbl, "ssize", sym_new_type(ssize_type));
-    scope_add_typesym(predecl_symtbl, "uint", sym_new_type(uint_type));
-    scope_add_typesym(predecl_symtbl, "uint8", sym_new_type(uint8_type));
-    scope_add_typesym(predecl_symtbl, "uint16", sym_new_type(uint16_type));
-    scope_add_typesym(predecl_symtbl, "uint32", sym_new_type(uint32_type));
-    scope_add_typesym(predecl_symtbl, "uint64", sym_new_type(uint64_type));
-    scope_add_typesym(predecl_symtbl, "size", sym_new_type(size_type));
-    scope_add_typesym(predecl_symtbl, "float", sym_new_type(float_type));
-    scope_add_typesym(predecl_symtbl, "double", sym_new_type(double_type));
-    scope_add_typesym(predecl_symtbl, "bool", sym_new_type(bool_type));
-    scope_add_typesym(predecl_symtbl, "char", sym_new_type(char_type));
-    scope_add_typesym(predecl_symtbl, "void", sym_new_type(void_type));
-
-    current_scope = global_scope = scope_new(predecl_symtbl, 65536, 8192);
+    codegen_to_shards(ast, fp, NULL);
+}
+
+size_t codegen_to_shards(struct ast *ast, FILE *fp, const char *prefix)
+{
+    current_scope = scope_new();
+
+    scope_add_typesym(current_scope, atom_new("int"), sym_new_type(int_type));
+    scope_add_typesym(current_scope, atom_new("int8"), sym_new_type(int8_type));
+    scope_add_typesym(current_scope, atom_new("int16"), sym_new_type(int16_type));
+    scope_add_typesym(current_scope, atom_new("int32"), sym_new_type(int32_type));
+    scope_add_typesym(current_scope, atom_new("int64"), sym_new_type(int64_type));
+    scope_add_typesym(current_scope, atom_new("ssize"), sym_new_type(ssize_type));
+    scope_add_typesym(current_scope, atom_new("uint"), sym_new_type(uint_type));
+    scope_add_typesym(current_scope, atom_new("uint8"), sym_new_type(uint8_type));
+    scope_add_typesym(current_scope, atom_new("uint16"), sym_new_type(uint16_type));
+    scope_add_typesym(current_scope, atom_new("uint32"), sym_new_type(uint32_type));
+    scope_add_typesym(current_scope, atom_new("uint64"), sym_new_type(uint64_type));
+    scope_add_typesym(current_scope, atom_new("size"), sym_new_type(size_type));
+    scope_add_typesym(current_scope, atom_new("float"), sym_new_type(float_type));
+    scope_add_typesym(current_scope, atom_new("double"), sym_new_type(double_type));
+    scope_add_typesym(current_scope, atom_new("bool"), sym_new_type(bool_type));
+    scope_add_typesym(current_scope, atom_new("char"), sym_new_type(char_type));
+    scope_add_typesym(current_scope, atom_new("void"), sym_new_type(void_type));
+
+    // The global symbols are in a scope of their own above the predeclared
+    // types, so they can shadow them.
+    scope_push(current_scope);
+    assert(scope_level(current_scope) == GLOBAL_SCOPE_LEVEL);
 
     zc_type_decls_rope = NULL;
     zc_type_defs_rope = NULL;
     zc_prog_decls_rope = NULL;
     zc_prog_defs_rope = NULL;
+    n_idents = 0;
+    n_helpers = 0;
+    n_global_decls = 0;
+    has_shared_local_types = false;
 
     decl_pass(ast);
-    codegen_pass(ast);
+
+    struct job_list list = { 0 };
+    codegen_pass(ast, &list);
+    reuse_frags(&list, ast);
+    size_t n_shards = 1;
+
+    if (zc_stream_output && prefix == NULL) {
+        stream_jobs(&list, fp);
+    } else {
+        gen_funcs(&list);
+        for (size_t i = 0; i < list.n_jobs; i++) {
+            if (list.jobs[i].frag != NULL)
+                add_frag_helpers(&list, &list.jobs[i]);
+        }
+
+        // A structure defined by one function and used by another has to be
+        // in the same shard.
+        if (prefix != NULL && !has_shared_local_types)
+            n_shards = write_shards(&list, fp, prefix);
+
+        if (n_shards == 1) {
+            emit_jobs(&list);
+
+            struct rope *zc_file_rope = zc_type_decls_rope;
+            zc_file_rope = rope_new_tree(zc_file_rope, zc_type_defs_rope);
+            zc_file_rope = rope_new_tree(zc_file_rope, zc_prog_decls_rope);
+            zc_file_rope = rope_new_tree(zc_file_rope, zc_prog_defs_rope);
+            rope_print_to_file(zc_file_rope, fp);
+        }
+
+        for (size_t i = 0; list.frag_writer != NULL && i < list.n_jobs; i++)
+            put_job_frag(&list, &list.jobs[i]);
+    }
+
+    // The code of the functions can only be reused one at a time if it does
+    // not depend on the other functions.
+    cache_close_frags(list.frag_writer, !has_shared_local_types);
+    cache_free_frags(&list.frags);
+    if (list.helper_index != NULL)
+        strmap_del(list.helper_index, NULL);
 
     ast_unref(ast);
 
-    struct rope *zc_file_rope = zc_type_decls_rope;
-    zc_file_rope = rope_new_tree(zc_file_rope, zc_type_defs_rope);
-    zc_file_rope = rope_new_tree(zc_file_rope, zc_prog_decls_rope);
-    zc_file_rope = rope_new_tree(zc_file_rope, zc_prog_defs_rope);
-    rope_print_to_file(zc_file_rope, fp);
+    for (size_t i = 0; i < list.n_tu_arenas; i++)
+        arena_free(&list.tu_arenas[i]);
+    free(list.tu_arenas);
+    free(list.jobs);
+
+    scope_del(current_scope);
+    current_scope = NULL;
+    return n_shards;
+}
+
+// Generate an identifier for a symbol local to the function generated.
+char *gen_c_ident(void)
+{
+    char *ident = arena_alloc(zc_arena, 13);
+    snprintf(ident, 13, "id%d", n_idents++);
+    return ident;
 }
 
-char *gen_c_ident()
+// Generate an identifier for a symbol in the file scope.  The identifiers
+// generated for a function include its name, so they do not depend on the
+// order the functions are generated in or on the other functions.
+char *gen_c_global_ident(void)
 {
-    static int n = 0;
-    char *ident = malloc(13);
-    snprintf(ident, 13, "id%d", n++);
+    if (zc_job == NULL) {
+        char *ident = arena_alloc(&zc_tu_arena, 13);
+        snprintf(ident, 13, "id%d", n_idents++);
+        return ident;
+    }
+
+    const char *name = ast_s(ast_ast(ast_ast(zc_job->ast, 0), 0));
+    size_t size = strlen(name) + 16;
+    char *ident = arena_alloc(&zc_tu_arena, size);
+    snprintf(ident, size, "id%d_%s", n_idents++, name);
     return ident;
 }
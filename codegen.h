@@ -18,8 +18,26 @@ struct rope *decl_to_c(struct decl_sym *decl);
 void add_global_decl(struct decl_sym *decl);
 void add_local_decl(struct decl_sym *decl);
 void add_type_decl(struct type *type);
+const char *add_expr_helper(struct expr expr, const char *name);
+
+// Record that the function generated uses the shared helper with name.
+void use_expr_helper(const char *name);
 char *gen_c_ident(void);
+char *gen_c_global_ident(void);
+
+// The function generated by the thread, or NULL outside of functions.
+extern _Thread_local struct func_job *zc_job;
+
+// Lock the state shared by the threads generating functions.
+void lock_globals(void);
+void unlock_globals(void);
 
 void codegen_to_file(struct ast *ast, FILE *fp); 
 
+// Generate the C code for ast split in shards which can be compiled
+// separately, and get the number of shards.  Shard 0 is written to fp, and
+// shard i to the file <prefix>.<i>.c.  Everything is written to fp if the code
+// cannot be split.
+size_t codegen_to_shards(struct ast *ast, FILE *fp, const char *prefix);
+
 #endif // !defined CODEGEN_H
@@ -1,13 +1,13 @@
 #include "zc.h"
 
-void error(struct loc *loc, const char *fmt, ...) {
+void error(loc_t loc, const char *fmt, ...) {
 	assert(fmt);
 
 	va_list va;
 	va_start(va, fmt);
 
-        if (loc != NULL)
-            fprintf(stderr, "%s:%d: error: ", loc->file, loc->line);
+        if (loc != NO_LOC)
+            fprintf(stderr, "%s:%d: error: ", loc_path(loc), loc_line(loc));
         else
             fprintf(stderr, "error: ");
 
@@ -17,14 +17,14 @@ void error(struct loc *loc, const char *fmt, ...) {
 	va_end(va);
 }
 
-void fatal(struct loc *loc, const char *fmt, ...) {
+void fatal(loc_t loc, const char *fmt, ...) {
 	assert(fmt);
 
 	va_list va;
 	va_start(va, fmt);
 
-        if (loc != NULL)
-            fprintf(stderr, "%s:%d: error: ", loc->file, loc->line);
+        if (loc != NO_LOC)
+            fprintf(stderr, "%s:%d: error: ", loc_path(loc), loc_line(loc));
         else
             fprintf(stderr, "error: ");
 
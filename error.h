@@ -2,10 +2,10 @@
 #define ERROR_H
 
 /* print error message */
-void error(struct loc *loc, const char *fmt, ...);
+void error(loc_t loc, const char *fmt, ...);
 
 /* print error message and exit program */
-noreturn void fatal(struct loc *loc, const char *fmt, ...);
+noreturn void fatal(loc_t loc, const char *fmt, ...);
 
 /* print error message and abort program */
 noreturn void bug(const char *fmt, ...);
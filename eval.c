@@ -90,6 +90,8 @@ const char *op_to_name(enum ast_tag tag)
             return "unary postfix --";
         case SIZEOF_EXPR:
             return "sizeof";
+        case OFFSETOF_EXPR:
+            return "offsetof";
         case SUBSCR_EXPR:
             return "array subscript";
         case CALL_EXPR:
@@ -157,6 +159,7 @@ int get_c_prec(enum ast_tag tag)
         case PRE_INC_EXPR:
         case PRE_DEC_EXPR:
         case SIZEOF_EXPR:
+        case OFFSETOF_EXPR:
         case DEREF_EXPR:
             return 14;
     }
@@ -268,9 +271,43 @@ void require_type(struct ast *ast, struct type *type, enum type_tag accept)
         invalid_type(ast);
 }
 
-void require_lval(struct ast *ast, struct type *type)
+// Check if an expression designates an object.  Types are shared, so this is
+// a property of the expression and not of its type.
+bool is_lval_expr(struct ast *ast)
 {
-    if (!is_lval_type(type))
+    switch (ast->tag) {
+        case NAME: {
+            struct sym *sym = scope_get_sym(current_scope, ast_s(ast));
+            if (sym != NULL && sym->tag == ALIAS_SYM)
+                return is_lval_expr(((struct alias_sym *)sym)->ast);
+            return sym != NULL && sym->tag == DECL_SYM;
+        }
+        case COMMA_EXPR:
+            return is_lval_expr(ast_ast(ast, 1));
+        case DECL:
+        case ASGN_EXPR:
+        case ADD_ASGN_EXPR:
+        case SUB_ASGN_EXPR:
+        case MUL_ASGN_EXPR:
+        case DIV_ASGN_EXPR:
+        case REM_ASGN_EXPR:
+        case OR_ASGN_EXPR:
+        case XOR_ASGN_EXPR:
+        case AND_ASGN_EXPR:
+        case SHL_ASGN_EXPR:
+        case SHR_ASGN_EXPR:
+        case DEREF_EXPR:
+        case SUBSCR_EXPR:
+        case MEMBER_EXPR:
+            return true;
+    }
+    return false;
+}
+
+// Require the operand of the operator ast to be an lvalue.
+void require_lval(struct ast *ast, struct ast *operand)
+{
+    if (!is_lval_expr(operand))
         not_lval(ast);
 }
 
@@ -298,7 +335,7 @@ struct type *eval_binop_type(struct ast *ast, enum ast_tag accept)
         incompatible_type(ast);
 
     require_type(ast, type, accept);
-    return type_dup(type, 0);
+    return type;
 }
 
 struct type *eval_relop_type(struct ast *ast, enum ast_tag accept)
@@ -319,8 +356,8 @@ struct type *eval_unop_type(struct ast *ast, enum ast_tag accept, bool lval_op)
 
     require_type(ast, type, accept);
     if (lval_op)
-        require_lval(ast, type);
-    return type_dup(type, 0);
+        require_lval(ast, ast_ast(ast, 0));
+    return type;
 }
 
 struct type *eval_add_type(struct ast *ast)
@@ -339,7 +376,7 @@ struct type *eval_add_type(struct ast *ast)
         incompatible_type(ast);
 
     require_type(ast, type, INT_TYPE | FLOAT_TYPE);
-    return type_dup(type, 0);
+    return type;
 }
 
 struct type *eval_sub_type(struct ast *ast)
@@ -348,10 +385,10 @@ struct type *eval_sub_type(struct ast *ast)
     struct type *rhs_type = ptr_decay(eval_type(NULL, ast_ast(ast, 1)));
 
     if (is_ptr_type(lhs_type) && is_int_type(rhs_type))
-        return type_dup(lhs_type, 0);
+        return lhs_type;
 
     if (is_int_type(lhs_type) && is_ptr_type(rhs_type))
-        return type_dup(rhs_type, 0);
+        return rhs_type;
 
     if (is_ptr_type(lhs_type) && is_ptr_type(rhs_type) &&
             type_equals(lhs_type, rhs_type))
@@ -362,13 +399,13 @@ struct type *eval_sub_type(struct ast *ast)
         incompatible_type(ast);
 
     require_type(ast, type, PTR_TYPE | INT_TYPE | FLOAT_TYPE);
-    return type_dup(type, 0);
+    return type;
 }
 
 struct type *eval_asgn_type(struct ast *ast)
 {
     struct type *lhs_type = eval_type(NULL, ast_ast(ast, 0));
-    require_lval(ast, lhs_type);
+    require_lval(ast, ast_ast(ast, 0));
 
     struct type *type;
     switch (ast->tag) {
@@ -402,13 +439,13 @@ struct type *eval_asgn_type(struct ast *ast)
     if (!type_equals(lhs_type, type))
         incompatible_type(ast);
 
-    return type_dup(type, LVAL_TYPE_FLAG);
+    return type;
 }
 
 struct type *eval_ref_type(struct ast *ast)
 {
     struct type *type = eval_type(NULL, ast_ast(ast, 0));
-    require_lval(ast, type);
+    require_lval(ast, ast_ast(ast, 0));
 
     return new_ptr_type(type);
 }
@@ -418,7 +455,7 @@ struct type *eval_deref_type(struct ast *ast)
     struct type *type = ptr_decay(eval_type(NULL, ast_ast(ast, 0)));
     require_type(ast, type, PTR_TYPE);
 
-    return type_dup(ptr_type(type)->to, LVAL_TYPE_FLAG);
+    return ptr_type(type)->to;
 }
 
 struct type *eval_sizeof_type(struct ast *ast)
@@ -430,12 +467,22 @@ struct type *eval_sizeof_type(struct ast *ast)
     return const_int_type;
 }
 
+struct type *eval_offsetof_type(struct ast *ast)
+{
+    struct ast *member_ast = ast_ast(ast, 0);
+    if (member_ast->tag != MEMBER_EXPR)
+        fatal(ast->loc, "operand to offsetof is not a member access");
+
+    eval_type(NULL, member_ast);
+    return const_int_type;
+}
+
 struct type *eval_cast_type(struct ast *ast)
 {
     struct type *rhs_type = type_from_ast(ast_ast(ast, 1));
     eval_type(rhs_type, ast_ast(ast, 0));
 
-    return type_dup(rhs_type, 0);
+    return rhs_type;
 }
 
 struct type *eval_subscr_type(struct ast *ast)
@@ -444,10 +491,10 @@ struct type *eval_subscr_type(struct ast *ast)
     struct type *rhs_type = ptr_decay(eval_type(NULL, ast_ast(ast, 1)));
 
     if (is_ptr_type(lhs_type) && is_int_type(rhs_type))
-        return type_dup(ptr_type(lhs_type)->to, LVAL_TYPE_FLAG);
+        return ptr_type(lhs_type)->to;
 
     if (is_int_type(lhs_type) && is_ptr_type(rhs_type))
-        return type_dup(ptr_type(lhs_type)->to, LVAL_TYPE_FLAG);
+        return ptr_type(lhs_type)->to;
 
     invalid_type(ast);
     return NULL;
@@ -492,16 +539,11 @@ struct type *eval_member_type(struct ast *ast)
     if (type_type(lhs_type->tag) != STRUCT_TYPE_FLAG)
         incompatible_type(ast);
 
-    size_t n_fields = struct_type(lhs_type)->n_fields;
-    struct field *fields = struct_type(lhs_type)->fields;
+    ptrdiff_t i = struct_field_index(struct_type(lhs_type), member_id);
+    if (i < 0)
+        fatal(ast->loc, "structure has no member %s", member_id);
 
-    for (size_t i = 0; i < n_fields; i++) {
-        if (strcmp(member_id, fields[i].name) == 0)
-            return type_dup(fields[i].type, LVAL_TYPE_FLAG);
-    }
-
-    fatal(ast->loc, "structure has no member %s", member_id);
-    return NULL;
+    return struct_type(lhs_type)->fields[i].type;
 }
 
 struct type *eval_str_lit_type(struct ast *ast)
@@ -512,6 +554,252 @@ struct type *eval_str_lit_type(struct ast *ast)
     return new_array_type(char_type, n_chars);
 }
 
+// Aliases with an expansion of more nodes than this are emitted as a helper
+// function, if they only reference global symbols.
+#define ALIAS_HELPER_MIN_SIZE 64
+
+// Helper function returning the expansion of an alias with a wanted type.
+struct alias_helper {
+    struct type *want;
+    const char *name;       // NULL if the expansion cannot be in a helper.
+    struct func_job *job;   // The function it belongs to, or NULL if global.
+    struct alias_helper *next;
+};
+
+// Cached expansions of an alias.  An alias is expanded where it is used, so
+// the names in it can refer to different symbols at each use.  The cached
+// values are therefore only valid while zc_scope_gen is unchanged.  Aliases
+// are shared by the threads generating functions, so the cache is only used
+// with the globals locked.
+struct alias_cache {
+    // Set while the size of the expansion is computed, to detect aliases
+    // which reference themselves.
+    bool is_expanding;
+
+    unsigned info_gen;
+    size_t size;    // Number of nodes in the expansion, saturated.
+    bool is_global; // The expansion only references global symbols.
+
+    unsigned expr_gen;
+    struct type *expr_want;
+    struct expr expr;
+
+    unsigned size_gen;
+    size_t size_val; // Value of the alias in a constant context.
+
+    // Helper functions for the wanted types the alias has been expanded
+    // with.  They can be used wherever is_global is true.
+    struct alias_helper *helpers;
+};
+
+static struct alias_cache *get_alias_info(struct ast *ast,
+        struct alias_sym *alias);
+
+// Add the number of nodes in the expansion of ast to size, and clear
+// is_global if it references a symbol which is not global.
+static void count_expansion(struct ast *ast, size_t *size, bool *is_global)
+{
+    if (ast == NULL)
+        return;
+
+    if (ast->tag == NAME) {
+        const char *name = ast_s(ast);
+        struct sym *sym = scope_get_sym(current_scope, name);
+
+        if (sym == NULL || sym != scope_get_global_sym(current_scope, name))
+            *is_global = false;
+
+        if (sym != NULL && sym->tag == ALIAS_SYM) {
+            struct alias_cache *cache = get_alias_info(ast,
+                    (struct alias_sym *)sym);
+            *size = *size > SIZE_MAX - cache->size ? SIZE_MAX :
+                *size + cache->size;
+            *is_global = *is_global && cache->is_global;
+            return;
+        }
+    }
+
+    // Declarations and structures create new symbols and types each time
+    // they are expanded.
+    if (ast->tag == DECL || ast->tag == STRUCT_EXPR)
+        *is_global = false;
+
+    if (*size < SIZE_MAX)
+        (*size)++;
+
+    // The member name of a member access is not a symbol, and counts as one
+    // node.
+    if (ast->tag == MEMBER_EXPR) {
+        count_expansion(ast_ast(ast, 0), size, is_global);
+        if (*size < SIZE_MAX)
+            (*size)++;
+        return;
+    }
+
+    if (ast_has_ast(ast->tag)) {
+        size_t n_childs;
+        struct ast **childs = ast_asts(ast, &n_childs);
+
+        for (size_t i = 0; i < n_childs; i++)
+            count_expansion(childs[i], size, is_global);
+    }
+}
+
+// Get the cache of an alias used at ast, with the size of the expansion
+// computed for the visible symbols.
+static struct alias_cache *get_alias_info(struct ast *ast,
+        struct alias_sym *alias)
+{
+    if (alias->cache == NULL) {
+        alias->cache = arena_alloc(&zc_tu_arena, sizeof *alias->cache);
+        memset(alias->cache, 0, sizeof *alias->cache);
+    }
+
+    struct alias_cache *cache = alias->cache;
+    if (cache->info_gen == zc_scope_gen && !cache->is_expanding)
+        return cache;
+
+    if (cache->is_expanding)
+        fatal(ast->loc, "alias '%s' references itself", ast_s(ast));
+
+    cache->is_expanding = true;
+    cache->size = 0;
+    cache->is_global = true;
+    count_expansion(alias->ast, &cache->size, &cache->is_global);
+    cache->is_expanding = false;
+    cache->info_gen = zc_scope_gen;
+
+    return cache;
+}
+
+// Check if values of a type can be returned by a helper function.
+static bool is_helper_type(struct type *type)
+{
+    if (type->tag == INT_CONST_TYPE || type->tag == FLOAT_CONST_TYPE)
+        return false;
+
+    return !(type->tag & (VOID_TYPE_FLAG | ARRAY_TYPE_FLAG | FUNC_TYPE_FLAG |
+                EXTERN_TYPE_FLAG));
+}
+
+// Generate the expression of an alias.  The expression is parenthesized when
+// it could bind differently where it is used, so the alias is used as a value
+// like in a helper function or a constant context.  Arithmetic prefix
+// operators need no parentheses, as their results cannot be the operand of a
+// postfix operator.
+static struct expr eval_alias_body(struct type *t, struct alias_sym *alias)
+{
+    struct expr expr = eval_expr(t, alias->ast);
+
+    enum ast_tag tag = alias->ast->tag;
+    if (expr.is_const)
+        return expr;
+
+    if (get_c_prec(tag) < get_c_prec(NEG_EXPR) || tag == DEREF_EXPR ||
+            tag == REF_EXPR || tag == PRE_INC_EXPR || tag == PRE_DEC_EXPR)
+        expr.rope = add_paren(expr.rope);
+
+    return expr;
+}
+
+// Get the name of the helper function of a global alias with wanted type t.
+// The name is made from the alias and the wanted type, so it does not depend
+// on which function first needed the helper.
+static const char *global_helper_name(struct type *t, const char *alias_name)
+{
+    size_t n = strlen(alias_name) + 21;
+    char *name = arena_alloc(&zc_tu_arena, n);
+
+    if (t == NULL) {
+        snprintf(name, n, "id_%s", alias_name);
+        return name;
+    }
+
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *c = rope_flatten(type_to_c(NULL, t))->val.s; *c; c++)
+        h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+
+    snprintf(name, n, "id_%s_%016llx", alias_name, (unsigned long long)h);
+    return name;
+}
+
+// Expand an alias with a large expansion which only references global
+// symbols.  Each expansion is emitted once as a helper function, so aliases
+// built from other aliases do not grow exponentially.  The helpers of global
+// aliases are shared by all functions, and the helpers of local aliases belong
+// to the function generated.
+static struct expr eval_alias_helper(struct type *t, struct ast *ast,
+        struct alias_sym *alias, struct alias_cache *cache)
+{
+    bool is_global_alias =
+        scope_get_global_sym(current_scope, ast_s(ast)) == &alias->sym;
+    struct func_job *job = is_global_alias ? NULL : zc_job;
+
+    struct alias_helper *helper = cache->helpers;
+    while (helper != NULL && (helper->want != t || helper->job != job))
+        helper = helper->next;
+
+    if (helper != NULL && helper->name != NULL) {
+        if (job == NULL)
+            use_expr_helper(helper->name);
+        return (struct expr){
+            .type = eval_type(t, alias->ast),
+            .rope = rope_new_fmt("%s()", helper->name)
+        };
+    }
+
+    struct expr expr = eval_alias_body(t, alias);
+    if (helper != NULL)
+        return expr;
+
+    helper = arena_alloc(&zc_tu_arena, sizeof *helper);
+    helper->want = t;
+    helper->name = NULL;
+    helper->job = job;
+    helper->next = cache->helpers;
+    cache->helpers = helper;
+
+    // Helpers are only named after wanted types with a name in C.
+    if (t != NULL && (t->tag == INT_CONST_TYPE || t->tag == FLOAT_CONST_TYPE))
+        return expr;
+
+    if (expr.is_const || !is_helper_type(expr.type) ||
+            is_lval_expr(alias->ast))
+        return expr;
+
+    const char *name = job == NULL ? global_helper_name(t, ast_s(ast)) : NULL;
+    helper->name = add_expr_helper(expr, name);
+    expr.rope = rope_new_fmt("%s()", helper->name);
+    return expr;
+}
+
+// Expand an alias used at ast.  An expansion is reused as long as the visible
+// symbols do not change.
+static struct expr eval_alias_expr(struct type *t, struct ast *ast,
+        struct alias_sym *alias, bool global_init)
+{
+    struct alias_cache *cache = get_alias_info(ast, alias);
+
+    // A helper cannot be called in the initializer of a global variable.
+    if (global_init)
+        return eval_alias_body(t, alias);
+
+    if (cache->expr_gen == zc_scope_gen && cache->expr_want == t &&
+            cache->expr.rope != NULL)
+        return cache->expr;
+
+    struct expr expr;
+    if (cache->is_global && cache->size > ALIAS_HELPER_MIN_SIZE)
+        expr = eval_alias_helper(t, ast, alias, cache);
+    else
+        expr = eval_alias_body(t, alias);
+
+    cache->expr_gen = zc_scope_gen;
+    cache->expr_want = t;
+    cache->expr = expr;
+    return expr;
+}
+
 struct type *eval_name_type(struct type *t, struct ast *ast)
 {
     const char *name = ast_s(ast);
@@ -525,11 +813,13 @@ struct type *eval_name_type(struct type *t, struct ast *ast)
         struct type *type = ((struct decl_sym *)sym)->type;
         if (type == NULL)
             fatal(ast->loc, "undeclared identifier '%s'", name);
-        return type_dup(type, LVAL_TYPE_FLAG);
+        return type;
     } else if (sym->tag == ALIAS_SYM) {
-        struct expr expr = eval_expr(t, ((struct alias_sym *)sym)->ast);
-        expr.rope = add_paren(expr.rope);
-        return expr.type;
+        lock_globals();
+        get_alias_info(ast, (struct alias_sym *)sym);
+        struct type *type = eval_type(t, ((struct alias_sym *)sym)->ast);
+        unlock_globals();
+        return type;
     }
 
     unreachable();
@@ -588,10 +878,10 @@ struct type *eval_init_type(struct type *t, struct ast *ast)
         fatal(ast->loc, "invalid type");
     }
 
-    return type_dup(t, 0);
+    return t;
 }
 
-struct type *eval_type(struct type *t, struct ast *ast)
+static struct type *eval_type_(struct type *t, struct ast *ast)
 {
     struct type *type;
     switch (ast->tag) {
@@ -686,6 +976,10 @@ struct type *eval_type(struct type *t, struct ast *ast)
             type = eval_sizeof_type(ast);
             break;
 
+        case OFFSETOF_EXPR:
+            type = eval_offsetof_type(ast);
+            break;
+
         case CAST_EXPR:
             type = eval_cast_type(ast);
             break;
@@ -749,7 +1043,62 @@ struct type *eval_type(struct type *t, struct ast *ast)
     return type;
 }
 
-size_t alignof_type(struct loc *loc, struct type *type)
+// Evaluate the type of an expression.  The type is cached in the node, so
+// evaluating the type of an expression which contains already evaluated
+// subexpressions does not need to walk them again.
+struct type *eval_type(struct type *t, struct ast *ast)
+{
+    if (ast->type_gen == zc_scope_gen && ast->type_want == t)
+        return ast->type;
+
+    struct type *type = eval_type_(t, ast);
+
+    ast->type = type;
+    ast->type_want = t;
+    ast->type_gen = zc_scope_gen;
+
+    return type;
+}
+
+// Compute the size, alignment and field offsets of a structure the way a C
+// compiler lays it out.
+static void compute_layout(loc_t loc, struct struct_type *type)
+{
+    size_t size = 0;
+    size_t align = 1;
+
+    for (size_t i = 0; i < type->n_fields; i++) {
+        struct field *field = &type->fields[i];
+        size_t field_align = alignof_type(loc, field->type);
+
+        field->offset = align_size(size, field_align);
+        size = field->offset + sizeof_type(loc, field->type);
+        if (field_align > align)
+            align = field_align;
+    }
+
+    type->size = align_size(size, align);
+    type->align = align;
+    __atomic_store_n(&type->has_layout, true, __ATOMIC_RELEASE);
+}
+
+// Get a structure with its layout computed.  The layout is computed once and
+// kept in the structure, which can be shared by the threads generating
+// functions.
+struct struct_type *struct_layout(loc_t loc, struct struct_type *type)
+{
+    if (__atomic_load_n(&type->has_layout, __ATOMIC_ACQUIRE))
+        return type;
+
+    lock_globals();
+    if (!type->has_layout)
+        compute_layout(loc, type);
+    unlock_globals();
+
+    return type;
+}
+
+size_t alignof_type(loc_t loc, struct type *type)
 {
     switch (type_type(type->tag)) {
         case VOID_TYPE_FLAG:
@@ -770,19 +1119,8 @@ size_t alignof_type(struct loc *loc, struct type *type)
             struct type *elem_type = array_type(type)->of;
             return alignof_type(loc, elem_type);
         }
-        case STRUCT_TYPE_FLAG: {
-            size_t n_fields = struct_type(type)->n_fields;
-            struct field *fields = struct_type(type)->fields;
-            size_t max_align = 1;
-
-            for (size_t i = 0; i < n_fields; i++) {
-                size_t align = alignof_type(loc, fields[i].type);
-                if (align > max_align)
-                    max_align = align;
-            }
-
-            return max_align;
-        }
+        case STRUCT_TYPE_FLAG:
+            return struct_layout(loc, struct_type(type))->align;
     }
 
     unreachable();
@@ -801,7 +1139,7 @@ size_t align_size(size_t size, size_t align)
  * TODO: The size calculating will probably be wrong on some architectures.
  * Hopefully it should be accurate on desktop comptuers.
  */
-size_t sizeof_type(struct loc *loc, struct type *type)
+size_t sizeof_type(loc_t loc, struct type *type)
 {
     switch (type_type(type->tag)) {
         case VOID_TYPE_FLAG:
@@ -819,31 +1157,36 @@ size_t sizeof_type(struct loc *loc, struct type *type)
             // pointers is different from regular pointers.
             return sizeof (void *);
         case ARRAY_TYPE_FLAG: {
+            // The size of the elements includes their trailing padding.
             struct type *elem_type = array_type(type)->of;
-            size_t elem_size = sizeof_type(loc, elem_type);
-            size_t elem_align = alignof_type(loc, elem_type);
-            size_t n_elems = array_type(type)->len;
-            return align_size(elem_size, elem_align) * n_elems;
-        }
-        case STRUCT_TYPE_FLAG: {
-            size_t n_fields = struct_type(type)->n_fields;
-            struct field *fields = struct_type(type)->fields;
-            size_t size = 0;
-
-            for (size_t i = 0; i < n_fields; i++) {
-                size_t field_size = sizeof_type(loc, fields[i].type);
-                size_t field_align = alignof_type(loc, fields[i].type);
-                size += align_size(field_size, field_align);
-            }
-
-            return size;
+            return sizeof_type(loc, elem_type) * array_type(type)->len;
         }
+        case STRUCT_TYPE_FLAG:
+            return struct_layout(loc, struct_type(type))->size;
     }
 
     unreachable();
     return 0;
 }
 
+// Get the offset of the member accessed by a MEMBER_EXPR node from the start
+// of the outermost structure of a chain of member accesses.
+size_t offsetof_member(struct ast *ast)
+{
+    struct ast *lhs_ast = ast_ast(ast, 0);
+    struct type *lhs_type = eval_type(NULL, lhs_ast);
+    eval_type(NULL, ast);
+
+    struct struct_type *type = struct_layout(ast->loc, struct_type(lhs_type));
+    ptrdiff_t i = struct_field_index(type, ast_s(ast_ast(ast, 1)));
+    size_t offset = type->fields[i].offset;
+
+    if (lhs_ast->tag == MEMBER_EXPR)
+        offset += offsetof_member(lhs_ast);
+
+    return offset;
+}
+
 size_t eval_name_size(struct ast *ast)
 {
     const char *name = ast_s(ast);
@@ -858,7 +1201,18 @@ size_t eval_name_size(struct ast *ast)
         unreachable();
     }
 
-    return eval_size(((struct alias_sym *)sym)->ast);
+    struct alias_sym *alias = (struct alias_sym *)sym;
+    lock_globals();
+    struct alias_cache *cache = get_alias_info(ast, alias);
+
+    if (cache->size_gen != zc_scope_gen) {
+        cache->size_val = eval_size(alias->ast);
+        cache->size_gen = zc_scope_gen;
+    }
+
+    size_t size = cache->size_val;
+    unlock_globals();
+    return size;
 }
 
 size_t eval_size(struct ast *ast)
@@ -910,6 +1264,10 @@ size_t eval_size(struct ast *ast)
         case SIZEOF_EXPR:
             return sizeof_type(ast->loc, eval_type(NULL, ast_ast(ast, 0)));
 
+        case OFFSETOF_EXPR:
+            eval_type(NULL, ast);
+            return offsetof_member(ast_ast(ast, 0));
+
         case INT_CONST:
             return ast_i(ast);
 
@@ -938,6 +1296,294 @@ size_t eval_size(struct ast *ast)
     return 0;
 }
 
+// Check if a C type of constants is unsigned.
+static bool is_unsigned_c_type(enum c_int_type t)
+{
+    return t == C_UNSIGNED || t == C_UNSIGNED_LONG;
+}
+
+// Get the number of bits of a C type of constants.  The generated code is
+// compiled for the machine the compiler runs on.
+static int c_type_bits(enum c_int_type t)
+{
+    return CHAR_BIT * (t >= C_LONG ? sizeof (long) : sizeof (int));
+}
+
+// Get the smallest and largest values of a signed C type of constants.
+static long long c_type_min(enum c_int_type t)
+{
+    return t == C_INT ? INT_MIN : LONG_MIN;
+}
+
+static long long c_type_max(enum c_int_type t)
+{
+    return t == C_INT ? INT_MAX : LONG_MAX;
+}
+
+// Get the bits of the values of an unsigned C type of constants.
+static unsigned long long c_type_mask(enum c_int_type t)
+{
+    return t == C_UNSIGNED ? UINT_MAX : ULONG_MAX;
+}
+
+// Get the C type of an integer literal in the generated code, which is the
+// first of int and long which can hold the value.
+static enum c_int_type literal_c_type(long long i)
+{
+    return i >= INT_MIN && i <= INT_MAX ? C_INT : C_LONG;
+}
+
+// Get the C type two operands are converted to by the usual arithmetic
+// conversions.
+static enum c_int_type common_c_type(enum c_int_type a, enum c_int_type b)
+{
+    // A long which cannot hold every unsigned value is converted to unsigned
+    // long.
+    if ((a == C_LONG && b == C_UNSIGNED) || (a == C_UNSIGNED && b == C_LONG))
+        return LONG_MAX >= UINT_MAX ? C_LONG : C_UNSIGNED_LONG;
+
+    return a > b ? a : b;
+}
+
+// Convert the constant expr to the C type t as C does.  Returns false if the
+// result is defined by the C compiler, which is when a value does not fit a
+// signed type.
+static bool convert_const(struct expr *expr, enum c_int_type t)
+{
+    if (is_unsigned_c_type(t)) {
+        expr->val = (unsigned long long)expr->val & c_type_mask(t);
+    } else {
+        if (expr->c_type == C_UNSIGNED_LONG && expr->val < 0)
+            return false;
+        if (expr->val < c_type_min(t) || expr->val > c_type_max(t))
+            return false;
+    }
+
+    expr->c_type = t;
+    return true;
+}
+
+// Make an expression of an integer or boolean constant with the C type
+// c_type.  The literal has the same C type, so the C compiler computes with it
+// what it would have with the expression it replaces.
+static struct expr new_int_const_expr(struct type *type, enum c_int_type c_type,
+        long long i)
+{
+    static const char *const suffixes[] = { "", "U", "L", "UL" };
+
+    struct rope *rope;
+    if (is_bool_type(type) && c_type == C_INT)
+        rope = i ? one_rope : zero_rope;
+    else if (is_unsigned_c_type(c_type))
+        rope = rope_new_fmt("%llu%s", (unsigned long long)i, suffixes[c_type]);
+    else
+        rope = rope_new_fmt("%lld%s", i, suffixes[c_type]);
+
+    return (struct expr){ .type = type, .rope = rope, .is_const = true,
+        .c_type = c_type, .val = i };
+}
+
+// Make the result of folding an operator, a value of the C type c_type, in
+// *res.  The smallest value of a signed type has no literal in C.
+static bool fold_to(struct type *type, enum c_int_type c_type, long long i,
+        struct expr *res)
+{
+    if (!is_unsigned_c_type(c_type) && i == c_type_min(c_type))
+        return false;
+
+    *res = new_int_const_expr(type, c_type, i);
+    return true;
+}
+
+// Get the precedence of an expression in C.  A folded constant is a literal,
+// which binds like a unary minus if it is negative.
+static int expr_prec(struct ast *ast, struct expr expr)
+{
+    if (!expr.is_const)
+        return get_c_prec(ast->tag);
+
+    bool neg = !is_unsigned_c_type(expr.c_type) && expr.val < 0;
+    return get_c_prec(neg ? NEG_EXPR : INT_CONST);
+}
+
+// Fold a shift of a constant into *res.  The result has the type of the
+// left operand.
+static bool fold_shift(enum ast_tag tag, struct type *type, struct expr lhs,
+        struct expr rhs, struct expr *res)
+{
+    enum c_int_type t = lhs.c_type;
+    long long a = lhs.val, n = rhs.val;
+
+    if (n < 0 || n >= c_type_bits(t))
+        return false;
+
+    if (is_unsigned_c_type(t)) {
+        unsigned long long ua = a;
+        ua = tag == SHL_EXPR ? ua << n : ua >> n;
+        return fold_to(type, t, ua & c_type_mask(t), res);
+    }
+
+    // Shifting a negative value, or a bit out of a positive one, is left to
+    // the C compiler.
+    if (a < 0 || (tag == SHL_EXPR && a > c_type_max(t) >> n))
+        return false;
+
+    return fold_to(type, t, tag == SHL_EXPR ? a << n : a >> n, res);
+}
+
+// Fold a binary operator with constant operands into *res.  The operands are
+// converted and the result computed in the C types of the operands.
+// Operations which overflow a signed type, or are otherwise undefined or
+// defined by the C compiler, are left to the C compiler.
+static bool fold_binop(enum ast_tag tag, struct type *type, struct expr lhs,
+        struct expr rhs, struct expr *res)
+{
+    if (!lhs.is_const || !rhs.is_const)
+        return false;
+
+    switch (tag) {
+        case LAND_EXPR:
+            return fold_to(type, C_INT, lhs.val && rhs.val, res);
+        case LOR_EXPR:
+            return fold_to(type, C_INT, lhs.val || rhs.val, res);
+        case SHL_EXPR:
+        case SHR_EXPR:
+            if (is_unsigned_c_type(rhs.c_type) && rhs.val < 0)
+                return false;
+            return fold_shift(tag, type, lhs, rhs, res);
+    }
+
+    enum c_int_type t = common_c_type(lhs.c_type, rhs.c_type);
+    if (!convert_const(&lhs, t) || !convert_const(&rhs, t))
+        return false;
+
+    long long a = lhs.val, b = rhs.val;
+    unsigned long long ua = a, ub = b;
+
+    if (is_unsigned_c_type(t)) {
+        unsigned long long u;
+        switch (tag) {
+            case ADD_EXPR: u = ua + ub; break;
+            case SUB_EXPR: u = ua - ub; break;
+            case MUL_EXPR: u = ua * ub; break;
+            case DIV_EXPR:
+            case REM_EXPR:
+                if (ub == 0)
+                    return false;
+                u = tag == DIV_EXPR ? ua / ub : ua % ub;
+                break;
+            case OR_EXPR: u = ua | ub; break;
+            case XOR_EXPR: u = ua ^ ub; break;
+            case AND_EXPR: u = ua & ub; break;
+            case EQ_EXPR: return fold_to(type, C_INT, ua == ub, res);
+            case NE_EXPR: return fold_to(type, C_INT, ua != ub, res);
+            case LT_EXPR: return fold_to(type, C_INT, ua < ub, res);
+            case GT_EXPR: return fold_to(type, C_INT, ua > ub, res);
+            case LE_EXPR: return fold_to(type, C_INT, ua <= ub, res);
+            case GE_EXPR: return fold_to(type, C_INT, ua >= ub, res);
+            default: return false;
+        }
+        return fold_to(type, t, u & c_type_mask(t), res);
+    }
+
+    long long i;
+    switch (tag) {
+        case ADD_EXPR:
+            if ((b > 0 && a > LLONG_MAX - b) || (b < 0 && a < LLONG_MIN - b))
+                return false;
+            i = a + b;
+            break;
+        case SUB_EXPR:
+            if ((b < 0 && a > LLONG_MAX + b) || (b > 0 && a < LLONG_MIN + b))
+                return false;
+            i = a - b;
+            break;
+        case MUL_EXPR:
+            i = ua * ub;
+            if (a == -1 ? b == LLONG_MIN : b == -1 ? a == LLONG_MIN :
+                    a != 0 && i / a != b)
+                return false;
+            break;
+        case DIV_EXPR:
+        case REM_EXPR:
+            if (b == 0 || (a == c_type_min(t) && b == -1))
+                return false;
+            i = tag == DIV_EXPR ? a / b : a % b;
+            break;
+        case OR_EXPR: i = a | b; break;
+        case XOR_EXPR: i = a ^ b; break;
+        case AND_EXPR: i = a & b; break;
+        case EQ_EXPR: return fold_to(type, C_INT, a == b, res);
+        case NE_EXPR: return fold_to(type, C_INT, a != b, res);
+        case LT_EXPR: return fold_to(type, C_INT, a < b, res);
+        case GT_EXPR: return fold_to(type, C_INT, a > b, res);
+        case LE_EXPR: return fold_to(type, C_INT, a <= b, res);
+        case GE_EXPR: return fold_to(type, C_INT, a >= b, res);
+        default: return false;
+    }
+
+    // Signed overflow is undefined.
+    if (i < c_type_min(t) || i > c_type_max(t))
+        return false;
+
+    return fold_to(type, t, i, res);
+}
+
+// Fold a prefix operator with a constant operand into *res, in the C type of
+// the operand.
+static bool fold_preop(enum ast_tag tag, struct type *type, struct expr expr,
+        struct expr *res)
+{
+    if (!expr.is_const)
+        return false;
+
+    enum c_int_type t = expr.c_type;
+    long long i = expr.val;
+
+    switch (tag) {
+        case NOT_EXPR:
+            return fold_to(type, C_INT, !i, res);
+        case UPLUS_EXPR:
+            return fold_to(type, t, i, res);
+        case COMPL_EXPR:
+            if (is_unsigned_c_type(t))
+                return fold_to(type, t, ~(unsigned long long)i & c_type_mask(t), res);
+            return fold_to(type, t, ~i, res);
+        case NEG_EXPR:
+            if (is_unsigned_c_type(t))
+                return fold_to(type, t, -(unsigned long long)i & c_type_mask(t), res);
+            if (i == c_type_min(t))
+                return false;
+            return fold_to(type, t, -i, res);
+    }
+    return false;
+}
+
+// Check if the size of a type is known.  The size of an untyped constant is
+// left to the C compiler.
+static bool is_sized_type(struct type *type)
+{
+    if (type->tag == INT_CONST_TYPE || type->tag == FLOAT_CONST_TYPE)
+        return false;
+
+    switch (type_type(type->tag)) {
+        case BOOL_TYPE_FLAG:
+        case INT_TYPE_FLAG:
+        case FLOAT_TYPE_FLAG:
+        case PTR_TYPE_FLAG:
+            return true;
+        case ARRAY_TYPE_FLAG:
+            return is_sized_type(array_type(type)->of);
+        case STRUCT_TYPE_FLAG:
+            for (size_t i = 0; i < struct_type(type)->n_fields; i++) {
+                if (!is_sized_type(struct_type(type)->fields[i].type))
+                    return false;
+            }
+            return true;
+    }
+    return false;
+}
+
 struct expr eval_asgn_expr(struct ast *ast)
 {
     struct ast *lhs_ast = ast_ast(ast, 0);
@@ -965,8 +1611,8 @@ struct expr eval_asgn_expr(struct ast *ast)
     }
 
     int prec = get_c_prec(ast->tag);
-    int lhs_prec = get_c_prec(lhs_ast->tag);
-    int rhs_prec = get_c_prec(rhs_ast->tag);
+    int lhs_prec = expr_prec(lhs_ast, lhs_expr);
+    int rhs_prec = expr_prec(rhs_ast, rhs_expr);
 
     if (lhs_prec < prec || (lhs_prec == prec && is_rassoc(ast->tag)))
         lhs_expr.rope = add_paren(lhs_expr.rope);
@@ -991,9 +1637,15 @@ struct expr eval_comma_expr(struct type *t, struct ast *ast)
     struct expr lhs_expr = eval_expr(NULL, lhs_ast);
     struct expr rhs_expr = eval_expr(t, rhs_ast);
 
+    // The left operand of a constant has no effect.
+    if (lhs_expr.is_const) {
+        rhs_expr.type = eval_type(NULL, ast);
+        return rhs_expr;
+    }
+
     int prec = get_c_prec(ast->tag);
-    int lhs_prec = get_c_prec(lhs_ast->tag);
-    int rhs_prec = get_c_prec(rhs_ast->tag);
+    int lhs_prec = expr_prec(lhs_ast, lhs_expr);
+    int rhs_prec = expr_prec(rhs_ast, rhs_expr);
 
     if (lhs_prec < prec || (lhs_prec == prec && is_rassoc(ast->tag)))
         lhs_expr.rope = add_paren(lhs_expr.rope);
@@ -1019,9 +1671,13 @@ struct expr eval_binop_expr(struct ast *ast, struct rope *c_op)
     struct expr lhs_expr = eval_expr(NULL, lhs_ast);
     struct expr rhs_expr = eval_expr(NULL, rhs_ast);
 
+    struct expr res;
+    if (fold_binop(ast->tag, eval_type(NULL, ast), lhs_expr, rhs_expr, &res))
+        return res;
+
     int prec = get_c_prec(ast->tag);
-    int lhs_prec = get_c_prec(lhs_ast->tag);
-    int rhs_prec = get_c_prec(rhs_ast->tag);
+    int lhs_prec = expr_prec(lhs_ast, lhs_expr);
+    int rhs_prec = expr_prec(rhs_ast, rhs_expr);
 
     if (lhs_prec < prec || (lhs_prec == prec && is_rassoc(ast->tag)))
         lhs_expr.rope = add_paren(lhs_expr.rope);
@@ -1043,7 +1699,12 @@ struct expr eval_preop_expr(struct ast *ast, struct rope *c_op)
 {
     struct ast *expr_ast = ast_ast(ast, 0);
     struct expr expr = eval_expr(NULL, expr_ast);
-    if (get_c_prec(expr_ast->tag) < get_c_prec(ast->tag))
+
+    struct expr res;
+    if (fold_preop(ast->tag, eval_type(NULL, ast), expr, &res))
+        return res;
+
+    if (expr_prec(expr_ast, expr) < get_c_prec(ast->tag))
         expr.rope = add_paren(expr.rope);
 
     return (struct expr) {
@@ -1075,9 +1736,34 @@ struct expr eval_cond_expr(struct type *t, struct ast *ast)
     struct expr then_expr = eval_expr(t, then_ast);
     struct expr else_expr = eval_expr(t, else_ast);
 
+    // Only the chosen operand of a constant condition is emitted.  It is
+    // parenthesized if it binds less tightly than the conditional operator.
+    // The operands are converted to a common type in C, so a constant is only
+    // chosen if the other operand is one too, and is converted to their common
+    // type.  An operand which is not constant can be chosen if the other one
+    // is not, or is an int, which does not change the type in C.
+    if (cond_expr.is_const) {
+        struct ast *expr_ast = cond_expr.val ? then_ast : else_ast;
+        struct expr expr = cond_expr.val ? then_expr : else_expr;
+        struct expr other = cond_expr.val ? else_expr : then_expr;
+
+        bool is_chosen = expr.is_const ? other.is_const &&
+            convert_const(&expr, common_c_type(expr.c_type, other.c_type)) :
+            !other.is_const || other.c_type == C_INT;
+
+        if (is_chosen) {
+            if (expr.is_const)
+                expr = new_int_const_expr(type, expr.c_type, expr.val);
+            expr.type = type;
+            if (expr_prec(expr_ast, expr) <= get_c_prec(ast->tag))
+                expr.rope = add_paren(expr.rope);
+            return expr;
+        }
+    }
+
     int prec = get_c_prec(ast->tag);
-    int cond_prec = get_c_prec(cond_ast->tag);
-    int else_prec = get_c_prec(else_ast->tag);
+    int cond_prec = expr_prec(cond_ast, cond_expr);
+    int else_prec = expr_prec(else_ast, else_expr);
 
     if (cond_prec <= prec)
         cond_expr.rope = add_paren(cond_expr.rope);
@@ -1097,14 +1783,36 @@ struct expr eval_cond_expr(struct type *t, struct ast *ast)
     };
 }
 
+// A folded size has the type of sizeof in C, size_t, which is unsigned long
+// on the machines the compiler runs on.
 struct expr eval_sizeof_expr(struct ast *ast)
 {
     struct expr expr = eval_expr(NULL, ast_ast(ast, 0));
+    if (is_sized_type(expr.type))
+        return new_int_const_expr(const_int_type, C_UNSIGNED_LONG,
+                sizeof_type(ast->loc, expr.type));
+
+    // An untyped constant has the size of its C type.
+    if (expr.is_const && expr.type->tag == INT_CONST_TYPE) {
+        size_t size = expr.c_type >= C_LONG ? sizeof (long) : sizeof (int);
+        return new_int_const_expr(const_int_type, C_UNSIGNED_LONG, size);
+    }
+
     struct rope *rope = rope_new_tree(sizeof_sp_rope, expr.rope);
 
     return (struct expr){ .type = const_int_type, .rope = rope };
 }
 
+// The offset is emitted as a constant, as C has no offsetof operator for
+// expressions.  It has the type of offsetof in C, size_t.
+struct expr eval_offsetof_expr(struct ast *ast)
+{
+    struct type *type = eval_type(NULL, ast);
+    size_t offset = offsetof_member(ast_ast(ast, 0));
+
+    return new_int_const_expr(type, C_UNSIGNED_LONG, offset);
+}
+
 struct expr eval_cast_expr(struct ast *ast)
 {
     // TODO check if cast is legal
@@ -1142,7 +1850,7 @@ struct expr eval_call_expr(struct ast *ast)
             arg_expr = eval_expr(called_type->params[i], arg_asts[i]);
         else
             arg_expr = eval_expr(NULL, arg_asts[i]);
-        if (get_c_prec(arg_asts[i]->tag) <= get_c_prec(COMMA_EXPR))
+        if (expr_prec(arg_asts[i], arg_expr) <= get_c_prec(COMMA_EXPR))
             arg_expr.rope = add_paren(arg_expr.rope);
 
         rope = rope_new_tree(rope, arg_expr.rope);
@@ -1197,7 +1905,7 @@ struct expr eval_member_expr(struct ast *ast)
     };
 }
 
-struct expr eval_name_expr(struct type *t, struct ast *ast)
+struct expr eval_name_expr(struct type *t, struct ast *ast, bool global_init)
 {
     const char *name = ast_s(ast);
     struct sym *sym = scope_get_sym(current_scope, name);
@@ -1210,8 +1918,13 @@ struct expr eval_name_expr(struct type *t, struct ast *ast)
                 .rope = rope_new_s(((struct decl_sym *)sym)->c_name),
                 .type = ((struct decl_sym *)sym)->type
             };
-        case ALIAS_SYM:
-            return eval_expr(t, ((struct alias_sym *)sym)->ast);
+        case ALIAS_SYM: {
+            lock_globals();
+            struct expr expr = eval_alias_expr(t, ast,
+                    (struct alias_sym *)sym, global_init);
+            unlock_globals();
+            return expr;
+        }
     }
     abort();
     return (struct expr){ 0 };
@@ -1219,11 +1932,8 @@ struct expr eval_name_expr(struct type *t, struct ast *ast)
 
 struct expr eval_int_const_expr(struct ast *ast)
 {
-    long long int i = ast_i(ast);
-    return (struct expr) {
-        .rope = rope_new_fmt("%lld", i),
-        .type = const_int_type
-    };
+    long long i = ast_i(ast);
+    return new_int_const_expr(const_int_type, literal_c_type(i), i);
 }
 
 struct expr eval_float_const_expr(struct ast *ast)
@@ -1283,7 +1993,7 @@ struct expr eval_decl_expr(struct ast *ast)
     struct type *type = eval_decl_type(ast);
 
     // Then evalute the name of the declared symbol.
-    return eval_name_expr(NULL, name_ast);
+    return eval_name_expr(NULL, name_ast, false);
 }
 
 struct expr eval_init_expr(struct type *t, struct ast *ast, bool global_init)
@@ -1433,6 +2143,8 @@ static struct expr eval_expr_(struct type *t, struct ast *ast, bool global_init)
 
         case SIZEOF_EXPR:
             return eval_sizeof_expr(ast);
+        case OFFSETOF_EXPR:
+            return eval_offsetof_expr(ast);
 
         case CAST_EXPR:
             return eval_cast_expr(ast);
@@ -1464,16 +2176,16 @@ static struct expr eval_expr_(struct type *t, struct ast *ast, bool global_init)
             return eval_str_lit_expr(ast);
 
         case TRUE_CONST:
-            return (struct expr) { .rope = one_rope, .type = eval_type(NULL, ast) };
+            return new_int_const_expr(eval_type(NULL, ast), C_INT, 1);
 
         case FALSE_CONST:
-            return (struct expr) { .rope = zero_rope, .type = eval_type(NULL, ast) };
+            return new_int_const_expr(eval_type(NULL, ast), C_INT, 0);
 
         case NULL_CONST:
             return (struct expr) { .rope = zero_rope, .type = eval_type(NULL, ast) };
 
         case NAME:
-            return eval_name_expr(t, ast);
+            return eval_name_expr(t, ast, global_init);
 
         case DECL:
             return eval_decl_expr(ast);
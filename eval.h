@@ -1,9 +1,27 @@
 #ifndef EVAL_H
 #define EVAL_H
 
+// The C types of constant expressions, after the integer promotions, in the
+// order of their conversion rank.
+enum c_int_type {
+    C_INT,
+    C_UNSIGNED,
+    C_LONG,
+    C_UNSIGNED_LONG,
+};
+
 struct expr {
     struct type *type;
     struct rope *rope;
+
+    // Set if the value of the expression is known at compile time, in which
+    // case the expression is emitted as a literal.  Only integer and boolean
+    // values are known, as floating point constants are left to the C compiler.
+    // The value has the C type c_type, which the expression would have in C,
+    // and unsigned values are kept as their bits.
+    bool is_const;
+    enum c_int_type c_type;
+    long long val;
 };
 
 struct type *common_type(struct type *a, struct type *b);
@@ -14,4 +32,9 @@ struct expr eval_expr(struct type *t, struct ast *ast);
 struct expr eval_expr_global(struct type *t, struct ast *ast);
 size_t eval_size(struct ast *ast);
 
+size_t align_size(size_t size, size_t align);
+size_t sizeof_type(loc_t loc, struct type *type);
+size_t alignof_type(loc_t loc, struct type *type);
+struct struct_type *struct_layout(loc_t loc, struct struct_type *type);
+
 #endif // !define EVAL_H
@@ -0,0 +1,11 @@
+extern int main(int, char **);
+extern int getchar(void);
+extern int putchar(int);
+
+int main(int id0, char **id1) {
+    int id2;
+    for (; (id2 = getchar()) != -1;) {
+        putchar(id2);
+    }
+    return 0;
+}
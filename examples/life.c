@@ -0,0 +1,98 @@
+extern _Bool grid[24][80];
+extern _Bool next[24][80];
+extern int countneigh(int, int);
+extern void evolve(void);
+extern void clear(void);
+extern int printf(char *, ...);
+extern void display(void);
+extern int putchar(int);
+extern void init(void);
+extern int rand(void);
+extern int main(void);
+extern void srand(int);
+extern int time(int *);
+extern int usleep(int);
+
+_Bool grid[24][80] = { };
+
+_Bool next[24][80] = { };
+
+int countneigh(int id0, int id1) {
+    int id2;
+    int id3;
+    int id4;
+    id2 = 0;
+    for (id3 = id0 - 1; id3 <= id0 + 1; id3++) {
+        if (id3 < 0 || id3 >= 24) {
+            continue;
+        }
+        for (id4 = id1 - 1; id4 <= id1 + 1; id4++) {
+            if (id4 < 0 || id4 >= 80) {
+                continue;
+            }
+            if (grid[id3][id4]) {
+                ++id2;
+            }
+        }
+    }
+    if (grid[id0][id1]) {
+        --id2;
+    }
+    return id2;
+}
+
+void evolve(void) {
+    int id0;
+    int id1;
+    int id2;
+    int id3;
+    int id4;
+    for (id0 = 0; id0 < 24; id0++) {
+        for (id1 = 0; id1 < 80; id1++) {
+            id2 = countneigh(id0, id1);
+            next[id0][id1] = id2 == 3 || id2 == 2 && grid[id0][id1];
+        }
+    }
+    for (id3 = 0; id3 < 24; id3++) {
+        for (id4 = 0; id4 < 80; id4++) {
+            grid[id3][id4] = next[id3][id4];
+        }
+    }
+}
+
+void clear(void) {
+    printf("\x1B[2J\x00");
+}
+
+void display(void) {
+    int id0;
+    int id1;
+    for (id0 = 0; id0 < 24; id0++) {
+        for (id1 = 0; id1 < 80; id1++) {
+            putchar(grid[id0][id1] ? 79 : 32);
+        }
+        putchar(10);
+    }
+}
+
+void init(void) {
+    int id0;
+    int id1;
+    for (id0 = 0; id0 < 24; id0++) {
+        for (id1 = 0; id1 < 80; id1++) {
+            grid[id0][id1] = rand() % 4 == 0;
+        }
+    }
+}
+
+int main(void) {
+    init();
+    srand(time(0));
+    for (;;) {
+        clear();
+        display();
+        usleep(250000);
+        evolve();
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+struct id1;
+struct id1 {
+    char *s;
+    struct id1 *next;
+};
+extern int main(void);
+extern char *fgets(char *, int, void *);
+extern void *stdin;
+extern void *malloc(unsigned long long);
+extern char *strdup(char *);
+extern void sort_lines(struct id1 **);
+extern void print_lines(struct id1 *);
+extern int printf(char *, ...);
+extern struct id1 *find_mid(struct id1 *);
+extern struct id1 *merge_lines(struct id1 *, struct id1 *);
+extern int strcmp(char *, char *);
+
+int main(void) {
+    struct id1 *id0;
+    struct id1 **id1;
+    char id2[1024];
+    id0 = 0;
+    id1 = &id0;
+    for (; fgets(id2, 1024, stdin) != 0;) {
+        *id1 = malloc(16);
+        (**id1).s = strdup(id2);
+        id1 = &(**id1).next;
+    }
+    *id1 = 0;
+    sort_lines(&id0);
+    print_lines(id0);
+}
+
+void print_lines(struct id1 *id0) {
+    struct id1 *id1;
+    for (id1 = id0; id1 != 0; id1 = (*id1).next) {
+        printf("%s\x00", (*id1).s);
+    }
+}
+
+void sort_lines(struct id1 **id0) {
+    struct id1 *id1;
+    struct id1 *id2;
+    struct id1 *id3;
+    id1 = *id0;
+    if (id1 == 0 || (*id1).next == 0) {
+return;    }
+    id2 = find_mid(id1);
+    id3 = (*id2).next;
+    (*id2).next = 0;
+    sort_lines(&id1);
+    sort_lines(&id3);
+    *id0 = merge_lines(id1, id3);
+}
+
+struct id1 *find_mid(struct id1 *id0) {
+    struct id1 *id1;
+    struct id1 *id2;
+    id1 = id0;
+    id2 = id0;
+    for (; id2 != 0 && (*id2).next != 0 && (*(*id2).next).next != 0;) {
+        id1 = (*id1).next;
+        id2 = (*(*id2).next).next;
+    }
+    return id1;
+}
+
+struct id1 *merge_lines(struct id1 *id0, struct id1 *id1) {
+    struct id1 *id2;
+    if (id0 == 0) {
+        return id1;
+    }
+    if (id1 == 0) {
+        return id0;
+    }
+    if (strcmp((*id0).s, (*id1).s) < 0) {
+        id2 = id0;
+        (*id0).next = merge_lines((*id0).next, id1);
+    } else {
+        id2 = id1;
+        (*id1).next = merge_lines(id0, (*id1).next);
+    }
+    return id2;
+}
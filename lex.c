@@ -2,38 +2,44 @@
 
 yylval_type yylval;
 static int last_tok = 0;
-char *lex_filepath;
+unsigned lex_file;
 int linenr = 0;
-FILE *yyin = NULL;
-
-struct {
-    char *str;
+const char *lex_cur;
+const char *lex_end;
+
+// Perfect hash table of the keywords.  The multipliers used by keyword_hash()
+// are searched for by tools/keyword_hash.c when the compiler is built, so that
+// every keyword gets a slot of its own, and a lookup only has to compare
+// against a single keyword.
+struct keyword_slot {
+    const char *str;
+    size_t n;
     int tok;
-} keywords[] = {
-    { "as", AS_TOK },
-    { "break", BREAK_TOK },
-    { "case", CASE_TOK },
-    { "continue", CONTINUE_TOK },
-    { "default", DEFAULT_TOK },
-    { "define", DEFINE_TOK },
-    { "else", ELSE_TOK },
-    { "fallthrough", FALLTHROUGH_TOK },
-    { "false", FALSE_TOK },
-    { "for", FOR_TOK },
-    { "goto", GOTO_TOK },
-    { "if", IF_TOK },
-    { "include", INCLUDE_TOK },
-    { "nil", NULL_TOK },
-    { "return", RETURN_TOK },
-    { "sizeof", SIZEOF_TOK },
-    { "switch", SWITCH_TOK },
-    { "true", TRUE_TOK },
-    { "type", TYPE_TOK },
 };
 
+#include "keyword_hash.h"
+
+static inline size_t keyword_hash(const char *s, size_t n)
+{
+    unsigned c0 = (unsigned char)s[0];
+    unsigned c1 = n > 1 ? (unsigned char)s[1] : 0;
+    size_t h = c0 * KEYWORD_MUL_0 + c1 * KEYWORD_MUL_1 + n * KEYWORD_MUL_2;
+    return h & (N_KEYWORD_SLOTS - 1);
+}
+
+// Get the keyword token for the identifier s of length n, or IDENT_TOK if it
+// is not a keyword.
+static inline int keyword_tok(const char *s, size_t n)
+{
+    const struct keyword_slot *slot = &keyword_slots[keyword_hash(s, n)];
+    if (slot->n == n && memcmp(slot->str, s, n) == 0)
+        return slot->tok;
+    return IDENT_TOK;
+}
+
 const char *tok_name(enum tok tok) {
     switch (tok) {
-#define tok_case(name, val)  \
+#define tok_case(name, val, keyword)  \
         case name: \
                    return #name;
         EXPAND_TOKENS(tok_case);
@@ -42,8 +48,74 @@ const char *tok_name(enum tok tok) {
     return NULL;
 }
 
-static void appendc(char **s, size_t *n, int c) {
-    *s = realloc(*s, *n + 1);
+// Read the source text of the file at path.  Returns false and sets errno if
+// the file could not be read.
+bool lex_src_open(struct lex_src *src, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        goto err;
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            src->data = data;
+            src->n = st.st_size;
+            src->is_mapped = true;
+            close(fd);
+            return true;
+        }
+    }
+
+    // Not a regular file (or it could not be mapped), read it instead.
+    size_t max_n = 4096;
+    src->data = malloc(max_n);
+    src->n = 0;
+    src->is_mapped = false;
+
+    for (;;) {
+        if (src->n == max_n) {
+            max_n *= 2;
+            src->data = realloc(src->data, max_n);
+        }
+
+        ssize_t n_read = read(fd, src->data + src->n, max_n - src->n);
+        if (n_read < 0) {
+            free(src->data);
+            goto err;
+        }
+        if (n_read == 0)
+            break;
+        src->n += n_read;
+    }
+
+    close(fd);
+    return true;
+
+err:;
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return false;
+}
+
+void lex_src_close(struct lex_src *src)
+{
+    if (src->is_mapped)
+        munmap(src->data, src->n);
+    else
+        free(src->data);
+}
+
+static void appendc(char **s, size_t *n, size_t *max_n, int c) {
+    if (*n == *max_n) {
+        *max_n = *max_n ? *max_n * 2 : 16;
+        *s = realloc(*s, *max_n);
+    }
     (*s)[*n] = c;
     (*n)++;
 }
@@ -78,25 +150,42 @@ int octdigit(int *val, int c)
     return -1;
 }
 
-int lex_getc() {
-    int c = getc(yyin);
+static inline int lex_getc(void) {
+    if (lex_cur == lex_end)
+        return EOF;
+
+    int c = (unsigned char)*lex_cur++;
     if (c == '\n')
         linenr++;
     return c;
 }
 
-int lex_ungetc(int c) {
+static inline void lex_ungetc(int c) {
+    if (c == EOF)
+        return;
+
     if (c == '\n')
         linenr--;
-    return ungetc(c, yyin);
+    lex_cur--;
+}
+
+// Count the newlines in the text from p up to end.
+static int count_lines(const char *p, const char *end)
+{
+    int n = 0;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        p++;
+        n++;
+    }
+    return n;
 }
 
-int esc_char(int quote, FILE *fp)
+int esc_char(int quote)
 {
     int c;
     while ((c = lex_getc()) != EOF) {
         if (c == '\n') {
-            fatal(loc_new(lex_filepath, linenr), "missing terminating %c",
+            fatal(loc_new(lex_file, linenr), "missing terminating %c",
                     quote);
             return EOF;
         }
@@ -110,7 +199,7 @@ int esc_char(int quote, FILE *fp)
                 int res = 0;
                 if (hexdigit(&res, c = lex_getc()) < 0) {
                     lex_ungetc(c);
-                    fatal(loc_new(lex_filepath, linenr),
+                    fatal(loc_new(lex_file, linenr),
                             "missing hex digit after \\x");
                     return 0;
                 }
@@ -156,29 +245,29 @@ int esc_char(int quote, FILE *fp)
 
 
 #define RETURN(TOK) do { \
-    yylval.linenr = loc_new(lex_filepath, linenr); \
+    yylval.linenr = loc_new(lex_file, linenr); \
     return last_tok = (TOK); \
 } while (false)
 
 void skip_line_comment(void)
 {
-    int c;
-    while ((c = lex_getc()) != EOF) {
-        if (c == '\n')
-            return;
+    const char *nl = memchr(lex_cur, '\n', lex_end - lex_cur);
+    if (nl == NULL) {
+        lex_cur = lex_end;
+        return;
     }
+
+    lex_cur = nl + 1;
+    linenr++;
 }
 
 void skip_block_comment(void)
 {
-    int prev_c = '\0';
-    int c;
-    while ((c = lex_getc()) != EOF) {
-        if (c == '/' && prev_c == '*') {
-            return;
-        }
-        prev_c = c;
-    }
+    const char *end = memmem(lex_cur, lex_end - lex_cur, "*/", 2);
+    end = end != NULL ? end + 2 : lex_end;
+
+    linenr += count_lines(lex_cur, end);
+    lex_cur = end;
 }
 
 int yylex(void)
@@ -190,61 +279,57 @@ int yylex(void)
         }
 
         if (isident(c)) {
-            size_t n = 0;
-            char *s = malloc(n);
-            appendc(&s, &n, c);
+            const char *s = lex_cur - 1;
+            while (lex_cur != lex_end && isidnum((unsigned char)*lex_cur))
+                lex_cur++;
+            size_t n = lex_cur - s;
 
-            while (isidnum(c = lex_getc())) {
-                appendc(&s, &n, c);
-            }
-            appendc(&s, &n, '\0');
-            lex_ungetc(c);
-
-            for (int i = 0; i < ARRAY_LEN(keywords); i++) {
-                if (strcmp(s, keywords[i].str) == 0) {
-                    free(s);
-                    RETURN(keywords[i].tok);
-                }
-            }
+            int tok = keyword_tok(s, n);
+            if (tok != IDENT_TOK)
+                RETURN(tok);
 
-            yylval.u.s = s;
+            yylval.u.s = (char *)atom_new_n(s, n);
             RETURN(IDENT_TOK);
         }
 
         if (isdigit(c)) {
-            size_t n = 0;
-            char *s = malloc(n);
-            appendc(&s, &n, c);
-
-            while (isidnum(c = lex_getc())) {
-                appendc(&s, &n, c);
-            }
-            appendc(&s, &n, '\0');
-            lex_ungetc(c);
-
-            char *p;
-            long long res = strtoll(s, &p, 0);
-            if (*p != '\0') {
-                error(loc_new(lex_filepath, linenr),
-                        "not a valid number %s\n", s);
+            const char *s = lex_cur - 1;
+            while (lex_cur != lex_end && isidnum((unsigned char)*lex_cur))
+                lex_cur++;
+            size_t n = lex_cur - s;
+
+            char buf[64];
+            long long res = 0;
+            if (n < sizeof buf) {
+                memcpy(buf, s, n);
+                buf[n] = '\0';
+
+                char *p;
+                res = strtoll(buf, &p, 0);
+                if (*p != '\0') {
+                    error(loc_new(lex_file, linenr),
+                            "not a valid number %s\n", buf);
+                }
+            } else {
+                error(loc_new(lex_file, linenr),
+                        "not a valid number %.*s\n", (int)n, s);
             }
 
-            free(s);
             yylval.u.i = res;
             RETURN(NUM_TOK);
         }
 
         if (c == '\'' || c == '"') {
             int quote = c;
-            size_t n = 0;
-            char *s = malloc(n);
+            size_t n = 0, max_n = 0;
+            char *s = NULL;
 
-            while ((c = esc_char(quote, yyin)) != EOF) {
-                appendc(&s, &n, c);
+            while ((c = esc_char(quote)) != EOF) {
+                appendc(&s, &n, &max_n, c);
             }
 
             if (quote == '"') {
-                appendc(&s, &n, '\0');
+                appendc(&s, &n, &max_n, '\0');
                 yylval.u.chars.s = s;
                 yylval.u.chars.n = n;
                 RETURN(STR_TOK);
@@ -255,7 +340,7 @@ int yylex(void)
                 yylval.u.i = 0;
             } else {
                 if (n > 1) {
-                    fatal(loc_new(lex_filepath, linenr),
+                    fatal(loc_new(lex_file, linenr),
                             "more than one character in character constant\n");
                 }
                 yylval.u.i = s[0];
@@ -1,63 +1,67 @@
 #ifndef LEX_H
 #define LEX_H
 
+// List of tokens with their values.  The last column is the spelling of
+// keyword tokens, or NULL for other tokens.
 #define EXPAND_TOKENS(X) \
-	X(EOF_TOK, 0) \
-	X(SIZEOF_TOK, 256) \
-	X(AS_TOK, 257) \
-	X(IF_TOK, 258) \
-	X(FOR_TOK, 261) \
-	X(RETURN_TOK, 262) \
-	X(GOTO_TOK, 263) \
-	X(BREAK_TOK, 264) \
-	X(CONTINUE_TOK, 265) \
-	X(ANDAND_TOK, 266) \
-	X(OROR_TOK, 267) \
-	X(GE_TOK, 268) \
-	X(LE_TOK, 269) \
-	X(EQ_TOK, 270) \
-	X(NE_TOK, 271) \
-	X(SHL_TOK, 272) \
-	X(SHR_TOK, 273) \
-	X(ADD_ASGN_TOK, 274) \
-	X(SUB_ASGN_TOK, 275) \
-	X(MUL_ASGN_TOK, 276) \
-	X(DIV_ASGN_TOK, 277) \
-	X(REM_ASGN_TOK, 278) \
-	X(SHL_ASGN_TOK, 279) \
-	X(SHR_ASGN_TOK, 280) \
-	X(OR_ASGN_TOK, 281) \
-	X(XOR_ASGN_TOK, 282) \
-	X(AND_ASGN_TOK, 283) \
-	X(DEC_TOK, 284) \
-	X(INC_TOK, 285) \
-	X(STR_TOK, 286) \
-	X(NUM_TOK, 287) \
-	X(IDENT_TOK, 288) \
-	X(ELSE_TOK, 289) \
-	X(ELLIPSIS_TOK, 290) \
-	X(TYPE_TOK, 291) \
-        X(NULL_TOK, 292) \
-        X(TRUE_TOK, 293) \
-        X(FALSE_TOK, 294) \
-        X(DEFINE_TOK, 295) \
-	X(FLOAT_NUM_TOK, 297) \
-	X(CASE_TOK, 298) \
-	X(DEFAULT_TOK, 299) \
-	X(FALLTHROUGH_TOK, 300) \
-	X(SWITCH_TOK, 301) \
-	X(INCLUDE_TOK, 302) \
-	X(STRCAT_TOK, 303)
+	X(EOF_TOK, 0, NULL) \
+	X(SIZEOF_TOK, 256, "sizeof") \
+	X(AS_TOK, 257, "as") \
+	X(IF_TOK, 258, "if") \
+	X(FOR_TOK, 261, "for") \
+	X(RETURN_TOK, 262, "return") \
+	X(GOTO_TOK, 263, "goto") \
+	X(BREAK_TOK, 264, "break") \
+	X(CONTINUE_TOK, 265, "continue") \
+	X(ANDAND_TOK, 266, NULL) \
+	X(OROR_TOK, 267, NULL) \
+	X(GE_TOK, 268, NULL) \
+	X(LE_TOK, 269, NULL) \
+	X(EQ_TOK, 270, NULL) \
+	X(NE_TOK, 271, NULL) \
+	X(SHL_TOK, 272, NULL) \
+	X(SHR_TOK, 273, NULL) \
+	X(ADD_ASGN_TOK, 274, NULL) \
+	X(SUB_ASGN_TOK, 275, NULL) \
+	X(MUL_ASGN_TOK, 276, NULL) \
+	X(DIV_ASGN_TOK, 277, NULL) \
+	X(REM_ASGN_TOK, 278, NULL) \
+	X(SHL_ASGN_TOK, 279, NULL) \
+	X(SHR_ASGN_TOK, 280, NULL) \
+	X(OR_ASGN_TOK, 281, NULL) \
+	X(XOR_ASGN_TOK, 282, NULL) \
+	X(AND_ASGN_TOK, 283, NULL) \
+	X(DEC_TOK, 284, NULL) \
+	X(INC_TOK, 285, NULL) \
+	X(STR_TOK, 286, NULL) \
+	X(NUM_TOK, 287, NULL) \
+	X(IDENT_TOK, 288, NULL) \
+	X(ELSE_TOK, 289, "else") \
+	X(ELLIPSIS_TOK, 290, NULL) \
+	X(TYPE_TOK, 291, "type") \
+        X(NULL_TOK, 292, "nil") \
+        X(TRUE_TOK, 293, "true") \
+        X(FALSE_TOK, 294, "false") \
+        X(DEFINE_TOK, 295, "define") \
+	X(FLOAT_NUM_TOK, 297, NULL) \
+	X(CASE_TOK, 298, "case") \
+	X(DEFAULT_TOK, 299, "default") \
+	X(FALLTHROUGH_TOK, 300, "fallthrough") \
+	X(SWITCH_TOK, 301, "switch") \
+	X(INCLUDE_TOK, 302, "include") \
+	X(STRCAT_TOK, 303, NULL)
 
 enum tok {
-#define member(name, val) name = val,
+#define member(name, val, keyword) name = val,
 	EXPAND_TOKENS(member)
 #undef member
 };
 
+// Value of a token.  For IDENT_TOK u.s is an atom.  For STR_TOK u.chars is an
+// allocated string.
 typedef struct yylval_type yylval_type;
 struct yylval_type {
-    struct loc *linenr;
+    loc_t linenr;
     union {
         long long i;
         char *s;
@@ -69,13 +73,28 @@ struct yylval_type {
     } u;
 };
 
+// Source text of a file.  The file is mapped into memory if possible,
+// otherwise it is read into an allocated buffer.
+struct lex_src {
+    char *data;
+    size_t n;
+    bool is_mapped;
+};
+
+bool lex_src_open(struct lex_src *src, const char *path);
+void lex_src_close(struct lex_src *src);
+
 extern yylval_type yylval;
-extern FILE *yyin;
 
 int yylex(void);
 int yylex_destroy(void);
 
-extern char *lex_filepath;
+// The source text being lexed.  lex_cur is the current position and lex_end
+// the end of the text.
+extern const char *lex_cur;
+extern const char *lex_end;
+
+extern unsigned lex_file;
 extern int linenr;
 
 const char *tok_name(enum tok tok);
@@ -1,29 +1,57 @@
 #include "zc.h"
 
-struct loc *loc_new(const char *file, int line)
+// Paths of the files in the file table, indexed by file index.  The paths are
+// atoms.
+static const char *loc_files[MAX_LOC_FILES];
+static unsigned n_loc_files = 1;
+
+// File index by path.  Entries for files removed from the table are left, and
+// are recognized by the path at their index.
+static struct strmap *loc_file_index;
+
+unsigned loc_file(const char *path)
+{
+    path = atom_new(path);
+
+    if (loc_file_index == NULL)
+        loc_file_index = strmap_new(0);
+
+    void **index = strmap_get_ptr(loc_file_index, path);
+    unsigned i = index != NULL ? (uintptr_t)*index : 0;
+    if (i != 0 && i < n_loc_files && loc_files[i] == path)
+        return i;
+
+    if (n_loc_files == MAX_LOC_FILES)
+        fatal(NO_LOC, "too many source files (max %u)", MAX_LOC_FILES - 1);
+
+    if (index != NULL)
+        *index = (void *)(uintptr_t)n_loc_files;
+    else
+        strmap_add(loc_file_index, path, (void *)(uintptr_t)n_loc_files);
+
+    loc_files[n_loc_files] = path;
+    return n_loc_files++;
+}
+
+unsigned loc_n_files(void)
 {
-    struct loc *l = malloc(sizeof *l);
-    l->line = line;
-    l->file = strdup(file);
-    l->nref = 1;
-    return l;
+    return n_loc_files;
 }
 
-void loc_del(struct loc *loc)
+void loc_reset_files(unsigned n_files)
 {
-    free(loc->file);
-    free(loc);
+    assert(n_files > 0 && n_files <= n_loc_files);
+    n_loc_files = n_files;
 }
 
-struct loc *loc_ref(struct loc *loc)
+const char *loc_path(loc_t loc)
 {
-    loc->nref++;
-    return loc;
+    unsigned file = loc_file_idx(loc);
+    assert(file > 0 && file < n_loc_files);
+    return loc_files[file];
 }
 
-void loc_unref(struct loc *loc)
+int loc_line(loc_t loc)
 {
-    // TODO: Fix memory leaks later
-    //if (--loc->nref == 0)
-    //    loc_del(loc);
+    return (uint32_t)loc;
 }
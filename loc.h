@@ -1,15 +1,45 @@
 #ifndef LOC_H
 #define LOC_H
 
-struct loc {
-    char *file;
-    int line;
-    int nref;
-};
+// Maximum number of files in the file table.  The table only has the files of
+// one translation unit at a time.
+#define MAX_LOC_FILES 4096u
 
-struct loc *loc_new(const char *file, int line);
+// Number of bits of a location used for the line number.  The index in the
+// file table is in the bits above them.
+#define LOC_LINE_BITS 32
 
-struct loc *loc_ref(struct loc *loc);
-void loc_unref(struct loc *loc);
+// Source location packed into 64 bits: an index into the file table and a line
+// number.  Index 0 is not used for any file so NO_LOC can be used where there
+// is no location.
+typedef uint64_t loc_t;
+
+#define NO_LOC ((loc_t)0)
+
+// Get the index of a file in the file table, adding it if it is not there.
+unsigned loc_file(const char *path);
+
+// Get the number of entries used in the file table.
+unsigned loc_n_files(void);
+
+// Remove the files from index n_files on from the file table, once there are no
+// locations in them left.
+void loc_reset_files(unsigned n_files);
+
+// Create location from file table index and line number.
+static inline loc_t loc_new(unsigned file, int line)
+{
+    return (loc_t)file << LOC_LINE_BITS | (uint32_t)line;
+}
+
+// Get the file table index of a location.
+static inline unsigned loc_file_idx(loc_t loc)
+{
+    return loc >> LOC_LINE_BITS;
+}
+
+// Get the path and line number of a location.
+const char *loc_path(loc_t loc);
+int loc_line(loc_t loc);
 
 #endif
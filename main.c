@@ -1,23 +1,33 @@
 #include "zc.h"
 
+// The number of threads used to generate the functions of a translation unit.
+int zc_n_jobs = 1;
+
+// Write the C code of each function as soon as it has been generated.
+bool zc_stream_output;
+
+// Directory of the on-disk cache, or NULL if the cache is disabled.
+const char *zc_cache_dir;
+
 // The amount of nested loops (used to know when continue or break is allowed)
-int zc_loop_level;
+_Thread_local int zc_loop_level;
 
 // The current indentation level when generating C code.
-int zc_indent_level;
+_Thread_local int zc_indent_level;
 
 // This variable is incremented for each structure created.  It is used to give
 // each structure an id when is used for comparing them for equality.
 int zc_n_struct_types;
 
-// The current local scope.
-struct scope *current_scope;
+// Incremented each time the visible symbols change.  Used to invalidate the
+// types cached in the AST by eval_type().
+_Thread_local unsigned zc_scope_gen = 1;
 
-// The scope with all global symbols.
-struct scope *global_scope;
+// The symbol table with the symbols visible in the current scope.
+_Thread_local struct scope *current_scope;
 
 // Return type of current function being generated
-struct type *zc_func_ret_type;
+_Thread_local struct type *zc_func_ret_type;
 
 // The global type declarations
 struct rope *zc_type_decls_rope;
@@ -32,19 +42,32 @@ struct rope *zc_prog_decls_rope;
 struct rope *zc_prog_defs_rope;
 
 // The local variable declarations in the current function
-struct rope *zc_func_decls_rope;
+_Thread_local struct rope *zc_func_decls_rope;
 
 // Labels (used or defined) in the current function
-struct strmap *zc_func_labels;
+_Thread_local struct strmap *zc_func_labels;
+
+// Arena for objects which live until the C code for the translation unit has
+// been generated: the AST, global symbols and types, and the output ropes.
+// The arena of a thread generating functions is kept until the output has been
+// written.
+_Thread_local struct arena zc_tu_arena;
+
+// Arena for objects only used while generating the C code for a function.  It
+// is reset after each function.
+_Thread_local struct arena zc_func_arena;
+
+// The arena new objects are allocated from.
+_Thread_local struct arena *zc_arena;
 
 void unrecognized_opt(const char *opt)
 {
-    fatal(NULL, "unrecognized command line option '%s'\n", opt);
+    fatal(NO_LOC, "unrecognized command line option '%s'\n", opt);
 }
 
 void missing_arg_for_opt(const char *opt)
 {
-    fatal(NULL, "missing argument for option '%s'\n", opt);
+    fatal(NO_LOC, "missing argument for option '%s'\n", opt);
 }
 
 char *get_file_ext(const char *filename)
@@ -81,17 +104,79 @@ struct arg_list *arg_list_new(const char *arg)
     return arg_list;
 }
 
-// Generate C code for file name and output to file handle.
-void gen_input_file(const char *file_name, FILE *output_fp)
+size_t arg_list_len(struct arg_list *arg_list)
 {
-    struct ast *ast = parse(file_name);
+    size_t n = 0;
+    for (; arg_list != NULL; arg_list = arg_list->next)
+        n++;
+
+    return n;
+}
+
+// Generate C code for the source files from src_files up to end as one
+// translation unit and output to file handle, split in shards if prefix is not
+// NULL, as by codegen_to_shards().  Returns the number of shards.  If deps is
+// not NULL, the files included are returned as by parse().
+size_t gen_input_shards(struct arg_list *src_files, struct arg_list *end,
+        FILE *output_fp, const char *prefix, struct include_dep **deps,
+        size_t *n_deps)
+{
+    const char *paths[arg_list_len(src_files)];
+    size_t n_files = 0;
+    for (struct arg_list *i = src_files; i != end; i = i->next)
+        paths[n_files++] = i->arg;
+
+    // The files of the translation unit are removed from the file table when
+    // its locations are freed with the arena.  When the code is streamed, the
+    // function bodies are parsed one at a time as they are generated.
+    unsigned n_loc_files = loc_n_files();
+    bool lazy_bodies = zc_stream_output && prefix == NULL;
+    struct ast *ast = parse_unity(paths, n_files, lazy_bodies, deps, n_deps);
+
+    size_t n_shards = codegen_to_shards(ast, output_fp, prefix);
+    parse_release_lazy();
+    arena_reset(&zc_tu_arena);
+    reset_types();
+    loc_reset_files(n_loc_files);
+    return n_shards;
+}
 
-    codegen_to_file(ast, output_fp);
+// Generate C code for the source files from src_files up to end and output to
+// file handle.  If deps is not NULL, the files included are returned as by
+// parse().
+void gen_input_file(struct arg_list *src_files, struct arg_list *end,
+        FILE *output_fp, struct include_dep **deps, size_t *n_deps)
+{
+    gen_input_shards(src_files, end, output_fp, NULL, deps, n_deps);
 }
 
-// Generate C code for source files and output to file name.
-void gen_c(struct arg_list *src_files, char *out)
+// Generate C code for source files and output to file name.  With unity, the
+// source files are one translation unit, which is output to out or to the C
+// file of the first source file.
+void gen_c(struct arg_list *src_files, char *out, bool unity)
 {
+    if (unity) {
+        char *c_file_name = out;
+        if (c_file_name == NULL) {
+            c_file_name = strdup(src_files->arg);
+            char *c_file_ext = get_file_ext(c_file_name);
+            c_file_ext[0] = 'c';
+            c_file_ext[1] = '\0';
+        }
+
+        FILE *fp;
+        if ((fp = fopen(c_file_name, "w")) == NULL) {
+            perror("fopen");
+            exit(1);
+        }
+
+        gen_input_file(src_files, NULL, fp, NULL, NULL);
+        fclose(fp);
+        if (c_file_name != out)
+            free(c_file_name);
+        return;
+    }
+
     if (out) {
         FILE *fp;
         if ((fp = fopen(out, "w")) == NULL) {
@@ -99,7 +184,7 @@ void gen_c(struct arg_list *src_files, char *out)
             exit(1);
         }
 
-        gen_input_file(src_files->arg, fp);
+        gen_input_file(src_files, src_files->next, fp, NULL, NULL);
         fclose(fp);
     }
 
@@ -115,7 +200,7 @@ void gen_c(struct arg_list *src_files, char *out)
             exit(1);
         }
         
-        gen_input_file(i->arg, fp);
+        gen_input_file(i, i->next, fp, NULL, NULL);
         fclose(fp);
         free(c_file_name);
     }
@@ -126,50 +211,106 @@ void print_ast_files(struct arg_list *src_files)
 {
     for (struct arg_list *i = src_files; i != NULL; i = i->next) {
         printf("--- FILE %s ---\n", i->arg);
-        struct ast *ast = parse(i->arg);
+        struct ast *ast = parse(i->arg, NULL, NULL);
         ast_print(ast, 0);
     }
 }
 
-// Invoke GCC on the source file, with GCC arguments.  gcc_args_tailp is a
-// pointer to the last element of the gcc_args linked list, used to append more
-// arguments.
-void invoke_gcc(struct arg_list *src_files, struct arg_list *gcc_args,
-        struct arg_list **gcc_args_tailp)
+// Get the directory of the on-disk cache: $CZC_CACHE_DIR, or czc in the cache
+// directory of the user.  Setting CZC_CACHE_DIR to the empty string disables
+// the cache.
+const char *get_cache_dir(void)
 {
-    // The beginning of the temporary file arguments passed to GCC (used to
-    // remove them after compilation).
-    struct arg_list **tmp_files = gcc_args_tailp;
+    const char *dir = getenv("CZC_CACHE_DIR");
+    if (dir != NULL)
+        return *dir != '\0' ? dir : NULL;
+
+    char *path = NULL;
+    int n = -1;
+    if ((dir = getenv("XDG_CACHE_HOME")) != NULL && *dir != '\0')
+        n = asprintf(&path, "%s/czc", dir);
+    else if ((dir = getenv("HOME")) != NULL && *dir != '\0')
+        n = asprintf(&path, "%s/.cache/czc", dir);
+
+    return n >= 0 ? path : NULL;
+}
 
-    char tmp_dir[] = "/tmp/czc.XXXXXX";
-    if (mkdtemp(tmp_dir) == NULL)
-        perror("mkdtemp");
+// Print memory usage statistics to stderr.
+void print_mem_stats(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "peak resident size:          %8ld KiB\n",
+            usage.ru_maxrss);
+    fprintf(stderr, "peak translation unit arena: %8zu KiB\n",
+            zc_tu_arena.max_n_bytes / 1024);
+    fprintf(stderr, "peak function arena:         %8zu KiB\n",
+            zc_func_arena.max_n_bytes / 1024);
+}
 
-    for (struct arg_list *i = src_files; i != NULL; i = i->next) {
-        // TODO: This does will not work if compiling dir0/a.zc and dir1/a.zc in
-        //       the same command.  A better solution should be implemented in
-        //       the future.
-        char *arg = basename(strdup(i->arg));
-        char *arg_ext = get_file_ext(arg);
-        if (arg_ext != NULL)
-            arg_ext[-1] = '\0';
+// The GCC process reading C code from a pipe while it is generated, or zero.
+static pid_t piped_gcc;
 
-        size_t n = strlen(tmp_dir) + 1 + strlen(arg) + 2;
-        char c_file_name[n + 1];
-        snprintf(c_file_name, sizeof c_file_name, "%s/%s.c", tmp_dir, arg);
+// A GCC process compiling the C code of a source file.  Its output is stored in
+// the cache for key when it succeeds, unless key is not valid.
+struct gcc_job {
+    pid_t pid;
+    struct cache_digest key;
+    char *out;
+};
 
-        FILE *fp;
-        if ((fp = fopen(c_file_name, "w")) == NULL)
-            perror(c_file_name);
+// The GCC processes started by invoke_gcc() which are running.
+static struct gcc_job gcc_jobs[MAX_JOBS];
+static int n_gcc_jobs;
 
-        gen_input_file(i->arg, fp);
+// The temporary files and directory created by invoke_gcc(), or NULL.
+static struct arg_list *tmp_files;
+static char *tmp_dir;
 
-        *gcc_args_tailp = arg_list_new(c_file_name);
-        gcc_args_tailp = &(*gcc_args_tailp)->next;
+// Record a temporary file to remove.
+static void add_tmp_file(const char *path)
+{
+    struct arg_list *tmp_file = arg_list_new(path);
+    tmp_file->next = tmp_files;
+    tmp_files = tmp_file;
+}
 
-        fclose(fp);
+// Remove the temporary files and directory.
+static void remove_tmp_files(void)
+{
+    for (struct arg_list *i = tmp_files; i != NULL; i = i->next)
+        unlink(i->arg);
+    arg_list_del(tmp_files);
+    tmp_files = NULL;
+
+    if (tmp_dir != NULL)
+        rmdir(tmp_dir);
+    free(tmp_dir);
+    tmp_dir = NULL;
+}
+
+// Clean up after invoke_gcc() when exiting because of an error.  The running
+// GCC processes are killed, so they do not report errors for incomplete code
+// or write to the temporary directory after it has been removed.
+static void cleanup_gcc(void)
+{
+    if (piped_gcc != 0)
+        kill(piped_gcc, SIGTERM);
+    for (int i = 0; i < n_gcc_jobs; i++)
+        kill(gcc_jobs[i].pid, SIGTERM);
+    if (piped_gcc != 0 || n_gcc_jobs > 0) {
+        while (wait(NULL) > 0 || errno == EINTR)
+            continue;
     }
 
+    remove_tmp_files();
+}
+
+// Start GCC with the arguments in the list and return its process id.  If
+// in_fd is not negative, it is used as the standard input of GCC.
+pid_t spawn_gcc(struct arg_list *gcc_args, int in_fd)
+{
     // Count number of arguments.
     size_t gcc_argc = 0;
     for (struct arg_list *i = gcc_args; i != NULL; i = i->next)
@@ -191,25 +332,375 @@ void invoke_gcc(struct arg_list *src_files, struct arg_list *gcc_args,
         perror("fork");
         exit(1);
     } else if (pid == 0) {
-        if (execvp("gcc", gcc_argv) < 0) {
-            perror("execvp");
+        if (in_fd >= 0)
+            dup2(in_fd, STDIN_FILENO);
+        signal(SIGPIPE, SIG_DFL);
+        execvp("gcc", gcc_argv);
+        perror("execvp");
+        _exit(1);
+    }
+
+    free(gcc_argv);
+    return pid;
+}
+
+// Wait for one of the running GCC processes to finish, and remove it from
+// jobs.  Returns its exit status, or 1 if it was killed by a signal.
+int wait_gcc(struct gcc_job *jobs, int *n_running)
+{
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+        perror("wait");
+        exit(1);
+    }
+
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    for (int i = 0; i < *n_running; ++i) {
+        if (jobs[i].pid != pid)
+            continue;
+
+        if (status == 0 && jobs[i].key.valid)
+            cache_put_file(jobs[i].key, jobs[i].out);
+
+        free(jobs[i].out);
+        jobs[i] = jobs[--*n_running];
+        break;
+    }
+
+    return status;
+}
+
+// Start GCC compiling the C code of a source file with cc_args.  The code is
+// read from the file c_file_name, or from in_fd if c_file_name is NULL.
+pid_t spawn_cc(struct arg_list *cc_args, struct arg_list **cc_args_tailp,
+        const char *cc_mode, const char *c_file_name, const char *out_name,
+        int in_fd)
+{
+    // Append the arguments for this file to cc_args.
+    struct arg_list **tailp = cc_args_tailp;
+    *tailp = arg_list_new(cc_mode);
+    tailp = &(*tailp)->next;
+
+    if (c_file_name != NULL) {
+        *tailp = arg_list_new(c_file_name);
+        tailp = &(*tailp)->next;
+    } else {
+        *tailp = arg_list_new("-x");
+        tailp = &(*tailp)->next;
+        *tailp = arg_list_new("c");
+        tailp = &(*tailp)->next;
+        *tailp = arg_list_new("-");
+        tailp = &(*tailp)->next;
+    }
+
+    *tailp = arg_list_new("-o");
+    tailp = &(*tailp)->next;
+    *tailp = arg_list_new(out_name);
+
+    pid_t pid = spawn_gcc(cc_args, in_fd);
+
+    arg_list_del(*cc_args_tailp);
+    *cc_args_tailp = NULL;
+    return pid;
+}
+
+// Invoke GCC on the source files.  Each source file gets compiled by its own
+// GCC process with cc_args as soon as its C code has been generated, so the
+// next file is generated while it compiles.  At most zc_n_jobs processes run at
+// a time.  cc_mode is the GCC flag selecting the output ("-c" or "-S"), or NULL
+// when generating an executable, in which case the object files are linked
+// with gcc_args.  gcc_args is also run when run_gcc_args is set, to handle the
+// input files which are not source files.  Exits with the status of GCC if it
+// fails.  The tail pointers point to the end of the argument lists, used to
+// append more arguments.
+//
+// If use_pipe is set, GCC is started before the C code is generated and reads
+// it from a pipe as it is streamed, so no C files are written.  Otherwise the C
+// code is written to temporary files.
+//
+// The outputs are cached.  They are looked up first by the source file and the
+// files it includes, which avoids generating the C code.  Without use_pipe they
+// are then looked up by the generated C code, which avoids running GCC when a
+// change of the source file does not change the C code.
+//
+// If use_shards is set and object files are generated without use_pipe, the C
+// code of a source file is split in shards.  Each shard is compiled by its own
+// GCC process and cached by its C code, and the objects of the shards are
+// combined into the object file of the source file.
+//
+// If unity is set, the source files are compiled as one translation unit by a
+// single GCC process, so GCC can inline functions across them.  The output is
+// named after the first source file.
+void invoke_gcc(struct arg_list *src_files, struct arg_list *cc_args,
+        struct arg_list **cc_args_tailp, struct arg_list *gcc_args,
+        struct arg_list **gcc_args_tailp, const char *cc_mode,
+        const char *out, bool run_gcc_args, bool use_pipe, bool use_shards,
+        bool unity)
+{
+    bool link = cc_mode == NULL;
+    if (link)
+        cc_mode = "-c";
+    use_shards = use_shards && !use_pipe && strcmp(cc_mode, "-c") == 0;
+
+    // The start of the cache keys, identifying the compilers and arguments.
+    struct cache_digest args_key = cache_compile_digest();
+    for (struct arg_list *i = cc_args; i != NULL; i = i->next)
+        args_key = cache_digest_str(args_key, i->arg);
+    args_key = cache_digest_str(args_key, cc_mode);
+
+    // The temporary directory is for the C files, and the object files to
+    // link.  It is removed with the temporary files in it when done, also when
+    // exiting because of an error.
+    atexit(cleanup_gcc);
+    char tmp_dir_name[] = "/tmp/czc.XXXXXX";
+    if (link || !use_pipe) {
+        if (mkdtemp(tmp_dir_name) != NULL)
+            tmp_dir = strdup(tmp_dir_name);
+        else
+            perror("mkdtemp");
+    }
+
+    // Writing to a GCC process which has exited is reported by its exit
+    // status.  The C code is streamed to GCC, so GCC reads each function while
+    // the next ones are generated.
+    if (use_pipe) {
+        signal(SIGPIPE, SIG_IGN);
+        zc_stream_output = true;
+    }
+
+    int status = 0;
+
+    struct arg_list *end;
+    for (struct arg_list *i = src_files; i != NULL && status == 0; i = end) {
+        // The source files of the translation unit.
+        end = unity ? NULL : i->next;
+
+        // TODO: This does will not work if compiling dir0/a.zc and dir1/a.zc in
+        //       the same command.  A better solution should be implemented in
+        //       the future.
+        char *arg = basename(strdup(i->arg));
+        char *arg_ext = get_file_ext(arg);
+        if (arg_ext != NULL)
+            arg_ext[-1] = '\0';
+
+        size_t n = strlen(tmp_dir_name) + 1 + strlen(arg) + 2;
+        char c_file_name[n + 1];
+        char o_file_name[n + 1];
+        char shard_prefix[n + 1];
+        snprintf(c_file_name, sizeof c_file_name, "%s/%s.c", tmp_dir_name, arg);
+        snprintf(o_file_name, sizeof o_file_name, "%s/%s.o", tmp_dir_name, arg);
+        snprintf(shard_prefix, sizeof shard_prefix, "%s/%s", tmp_dir_name, arg);
+
+        // The output file, named like GCC names it if there is no '-o'.
+        char default_out[strlen(arg) + 3];
+        snprintf(default_out, sizeof default_out, "%s.%c", arg,
+                strcmp(cc_mode, "-S") == 0 ? 's' : 'o');
+        const char *out_name = link ? o_file_name :
+            out != NULL ? out : default_out;
+
+        if (link) {
+            add_tmp_file(o_file_name);
+
+            *gcc_args_tailp = arg_list_new(o_file_name);
+            gcc_args_tailp = &(*gcc_args_tailp)->next;
+        }
+
+        // Look up the output by the source files and the files they include.
+        struct cache_digest src_key = args_key;
+        struct cache_digest out_key = { 0 };
+        for (struct arg_list *j = i; j != end; j = j->next)
+            src_key = cache_digest_file(cache_digest_str(src_key, j->arg),
+                    j->arg);
+
+        if (cache_load_manifest(src_key, &out_key) &&
+                cache_get_file(out_key, out_name)) {
+            cache_count(CACHE_SOURCE_HIT);
+            continue;
+        }
+
+        // Wait for a process to finish if as many as allowed are running.
+        // Without a pipe this is done after generating the C code, so it is
+        // generated while the previous files compile.
+        if (use_pipe && n_gcc_jobs == zc_n_jobs) {
+            status = wait_gcc(gcc_jobs, &n_gcc_jobs);
+            if (status != 0)
+                break;
+        }
+
+        FILE *fp;
+        pid_t pid = 0;
+        if (use_pipe) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) < 0) {
+                perror("pipe");
+                exit(1);
+            }
+
+            pid = spawn_cc(cc_args, cc_args_tailp, cc_mode, NULL, out_name,
+                    fds[0]);
+            close(fds[0]);
+            fp = fdopen(fds[1], "w");
+            piped_gcc = pid;
+        } else {
+            if ((fp = fopen(c_file_name, "w")) == NULL)
+                perror(c_file_name);
+
+            add_tmp_file(c_file_name);
+        }
+
+        struct include_dep *deps;
+        size_t n_deps;
+        size_t n_shards = gen_input_shards(i, end, fp,
+                use_shards ? shard_prefix : NULL, &deps, &n_deps);
+        fclose(fp);
+        piped_gcc = 0;
+
+        // The shards are named like the shards generated, with shard 0 being
+        // the C file.
+        char *shard_c[n_shards];
+        char *shard_o[n_shards];
+        shard_c[0] = strdup(c_file_name);
+        if (asprintf(&shard_o[0], "%s.0.o", shard_prefix) < 0) {
+            perror("asprintf");
             exit(1);
         }
+        for (size_t j = 1; j < n_shards; j++) {
+            if (asprintf(&shard_c[j], "%s.%zu.c", shard_prefix, j) < 0 ||
+                    asprintf(&shard_o[j], "%s.%zu.o", shard_prefix, j) < 0) {
+                perror("asprintf");
+                exit(1);
+            }
+
+            add_tmp_file(shard_c[j]);
+        }
+
+        // The output is stored by the generated C code, or by the source file
+        // and its includes if the C code is not kept.
+        if (use_pipe)
+            out_key = cache_deps_digest(src_key, deps, n_deps);
+        else
+            out_key = cache_digest_file(args_key, c_file_name);
+        for (size_t j = 1; j < n_shards; j++)
+            out_key = cache_digest_file(out_key, shard_c[j]);
+
+        if (src_key.valid && out_key.valid)
+            cache_store_manifest(src_key, deps, n_deps, out_key);
+        free(deps);
+
+        bool is_cached = !use_pipe && cache_get_file(out_key, out_name);
+        if (out_key.valid)
+            cache_count(is_cached ? CACHE_C_HIT : CACHE_MISS);
+
+        // The shards are compiled, or taken from the cache by their C code,
+        // and then combined into the output.
+        if (n_shards > 1 && !is_cached) {
+            for (size_t j = 0; j < n_shards && status == 0; j++) {
+                add_tmp_file(shard_o[j]);
+
+                struct cache_digest key = cache_digest_file(args_key,
+                        shard_c[j]);
+                if (cache_get_file(key, shard_o[j])) {
+                    cache_count(CACHE_SHARD_HIT);
+                    continue;
+                }
+                cache_count(CACHE_SHARD_MISS);
+
+                if (n_gcc_jobs == zc_n_jobs) {
+                    status = wait_gcc(gcc_jobs, &n_gcc_jobs);
+                    if (status != 0)
+                        break;
+                }
+
+                pid = spawn_cc(cc_args, cc_args_tailp, cc_mode, shard_c[j],
+                        shard_o[j], -1);
+                gcc_jobs[n_gcc_jobs++] = (struct gcc_job){ pid, key,
+                    strdup(shard_o[j]) };
+            }
+
+            while (n_gcc_jobs > 0) {
+                int s = wait_gcc(gcc_jobs, &n_gcc_jobs);
+                if (status == 0)
+                    status = s;
+            }
+
+            if (status == 0) {
+                struct arg_list *ld_args = arg_list_new("gcc");
+                struct arg_list **tailp = &ld_args->next;
+                const char *ld_opts[] = { "-nostdlib", "-r", "-o", out_name };
+                for (size_t j = 0; j < ARRAY_LEN(ld_opts); j++) {
+                    *tailp = arg_list_new(ld_opts[j]);
+                    tailp = &(*tailp)->next;
+                }
+                for (size_t j = 0; j < n_shards; j++) {
+                    *tailp = arg_list_new(shard_o[j]);
+                    tailp = &(*tailp)->next;
+                }
+
+                gcc_jobs[n_gcc_jobs++] = (struct gcc_job){
+                    spawn_gcc(ld_args, -1), out_key, strdup(out_name) };
+                arg_list_del(ld_args);
+            }
+        }
+
+        for (size_t j = 0; j < n_shards; j++) {
+            free(shard_c[j]);
+            free(shard_o[j]);
+        }
+
+        if (is_cached || n_shards > 1)
+            continue;
+
+        if (!use_pipe) {
+            if (n_gcc_jobs == zc_n_jobs) {
+                status = wait_gcc(gcc_jobs, &n_gcc_jobs);
+                if (status != 0)
+                    break;
+            }
+
+            pid = spawn_cc(cc_args, cc_args_tailp, cc_mode, c_file_name,
+                    out_name, -1);
+        }
+
+        gcc_jobs[n_gcc_jobs++] = (struct gcc_job){ pid, out_key, strdup(out_name) };
+    }
+
+    while (n_gcc_jobs > 0) {
+        int s = wait_gcc(gcc_jobs, &n_gcc_jobs);
+        if (status == 0)
+            status = s;
     }
 
-    waitpid(pid, NULL, 0);
+    if (status == 0 && (link || run_gcc_args)) {
+        gcc_jobs[n_gcc_jobs++] = (struct gcc_job){ spawn_gcc(gcc_args, -1),
+            { 0 }, NULL };
+        status = wait_gcc(gcc_jobs, &n_gcc_jobs);
+    }
 
-    // Remove the created temporary files.
-    for (struct arg_list *i = *tmp_files; i != NULL; i = i->next)
-        unlink(i->arg);
+    remove_tmp_files();
+
+    if (status != 0)
+        exit(status);
 }
 
-int main(int argc, char **argv)
+int czc_main(int argc, char **argv)
 {
+    zc_arena = &zc_tu_arena;
+
     char *out = NULL;
+    bool mem_stats = false;
+    bool use_cache = true;
+    bool use_pipe = false;
+    bool use_shards = false;
+    bool unity = false;
 
     struct arg_list *gcc_args = arg_list_new("gcc");
     struct arg_list **gcc_args_tailp = &gcc_args->next;
+    // The arguments for compiling the C code of a source file, which is
+    // gcc_args without the input files, output and link options.
+    struct arg_list *cc_args = arg_list_new("gcc");
+    struct arg_list **cc_args_tailp = &cc_args->next;
     struct arg_list *src_files = NULL;
     struct arg_list **src_files_tailp = &src_files;
 
@@ -217,25 +708,33 @@ int main(int argc, char **argv)
     // messages which doesn't have color.
     *gcc_args_tailp = arg_list_new("-fno-diagnostics-color");
     gcc_args_tailp = &(*gcc_args_tailp)->next;
+    *cc_args_tailp = arg_list_new("-fno-diagnostics-color");
+    cc_args_tailp = &(*cc_args_tailp)->next;
 
     // We don't want warnings from GCC to leak through.  Will still output
     // errors if the generated code does not compile.
     *gcc_args_tailp = arg_list_new("-w");
     gcc_args_tailp = &(*gcc_args_tailp)->next;
+    *cc_args_tailp = arg_list_new("-w");
+    cc_args_tailp = &(*cc_args_tailp)->next;
 
     // Tell GCC that the source has been preprocessed.  This is to avoid having
     // to escape trigraphs in the generated C code.
     *gcc_args_tailp = arg_list_new("-fpreprocessed");
     gcc_args_tailp = &(*gcc_args_tailp)->next;
+    *cc_args_tailp = arg_list_new("-fpreprocessed");
+    cc_args_tailp = &(*cc_args_tailp)->next;
 
     int input_file_count = 0;
+    bool other_input_files = false;
 
     enum {
         TO_EXE,
         TO_C,
         TO_ASM,
         TO_OBJ,
-        AST_PRINT
+        AST_PRINT,
+        CACHE_STATS
     } mode = TO_EXE;
 
     for (int i = 1; i < argc; ++i) {
@@ -244,6 +743,40 @@ int main(int argc, char **argv)
                 mode = AST_PRINT;
                 continue;
             }
+            if (strcmp(argv[i], "--mem-stats") == 0) {
+                mem_stats = true;
+                continue;
+            }
+            if (strcmp(argv[i], "--stream") == 0) {
+                zc_stream_output = true;
+                continue;
+            }
+            if (strcmp(argv[i], "--shards") == 0) {
+                use_shards = true;
+                continue;
+            }
+            if (strcmp(argv[i], "--unity") == 0) {
+                unity = true;
+                continue;
+            }
+            if (strcmp(argv[i], "--no-cache") == 0) {
+                use_cache = false;
+                continue;
+            }
+            // Like with GCC, '-pipe' uses pipes rather than temporary files.
+            // It is also passed on to GCC.
+            if (strcmp(argv[i], "-pipe") == 0) {
+                use_pipe = true;
+                *gcc_args_tailp = arg_list_new(argv[i]);
+                gcc_args_tailp = &(*gcc_args_tailp)->next;
+                *cc_args_tailp = arg_list_new(argv[i]);
+                cc_args_tailp = &(*cc_args_tailp)->next;
+                continue;
+            }
+            if (strcmp(argv[i], "--cache-stats") == 0) {
+                mode = CACHE_STATS;
+                continue;
+            }
             if (strcmp(argv[i], "--to-c") == 0) {
                 mode = TO_C;
                 *gcc_args_tailp = arg_list_new(argv[i]);
@@ -254,11 +787,13 @@ int main(int argc, char **argv)
             switch (argv[i][1]) {
                 // These options require thir arguments to be in the option
                 // flag.  Their arguments can be anything.  They are copied
-                // directly to the GCC command-line.
+                // directly to the GCC command-lines.
                 case 'O':
                 case 'f':
                     *gcc_args_tailp = arg_list_new(argv[i]);
                     gcc_args_tailp = &(*gcc_args_tailp)->next;
+                    *cc_args_tailp = arg_list_new(argv[i]);
+                    cc_args_tailp = &(*cc_args_tailp)->next;
                     break;
 
                 // The '-o' option doesn't require its arguments to be in the
@@ -271,7 +806,7 @@ int main(int argc, char **argv)
                     gcc_args_tailp = &(*gcc_args_tailp)->next;
 
                     if (argv[i][2] != '\0') {
-                        out = argv[i] + 1;
+                        out = argv[i] + 2;
                     } else {
                         if ((out = argv[++i]) == NULL)
                             missing_arg_for_opt(argv[i - 1]);
@@ -298,6 +833,24 @@ int main(int argc, char **argv)
                     }
                     break;
 
+                // The number of threads generating the functions of each
+                // source file, and of GCC processes compiling the generated
+                // code.  The argument can be in the option flag or the next
+                // argv element.
+                case 'j': {
+                    const char *arg = argv[i] + 2;
+                    if (*arg == '\0' && (arg = argv[++i]) == NULL)
+                        missing_arg_for_opt(argv[i - 1]);
+
+                    char *end;
+                    long n = strtol(arg, &end, 10);
+                    if (*end != '\0' || n < 1 || n > MAX_JOBS)
+                        fatal(NO_LOC, "invalid number of jobs '%s'", arg);
+
+                    zc_n_jobs = n;
+                    break;
+                }
+
                 case 'c':
                     mode = TO_OBJ;
                     if (argv[i][2] != '\0')
@@ -335,6 +888,7 @@ int main(int argc, char **argv)
                     strcmp(ext, "ZC") != 0)) {
             *gcc_args_tailp = arg_list_new(argv[i]);
             gcc_args_tailp = &(*gcc_args_tailp)->next;
+            other_input_files = true;
             continue;
         }
 
@@ -342,30 +896,68 @@ int main(int argc, char **argv)
         src_files_tailp = &(*src_files_tailp)->next;
     }
 
+    if (use_cache)
+        zc_cache_dir = get_cache_dir();
+
+    if (mode == CACHE_STATS) {
+        cache_print_stats();
+        return 0;
+    }
+
+    // The statistics of the cache are saved when exiting, also on errors.
+    atexit(cache_save_stats);
+
     if (input_file_count == 0) {
-        fatal(NULL, "no input files");
+        fatal(NO_LOC, "no input files");
         exit(1);
     }
 
 
-    if (out != NULL && input_file_count != 1 && mode != TO_EXE) {
-        fatal(NULL, "cannot specify '-o' with '-c', '-S', or '-C' with "
+    // With --unity the source files have one output.
+    size_t n_outputs = input_file_count;
+    if (unity && src_files != NULL)
+        n_outputs -= arg_list_len(src_files) - 1;
+
+    if (out != NULL && n_outputs != 1 && mode != TO_EXE) {
+        fatal(NO_LOC, "cannot specify '-o' with '-c', '-S', or '-C' with "
                 "multiple files\n");
         exit(1);
     }
 
-    if (src_files != NULL) {
-        if (mode == TO_C) {
-            gen_c(src_files, out);
-        } else if (mode == AST_PRINT) {
-            print_ast_files(src_files);
-        } else {
-            invoke_gcc(src_files, gcc_args, gcc_args_tailp);
-        }
+    const char *cc_mode = mode == TO_OBJ ? "-c" : mode == TO_ASM ? "-S" : NULL;
+
+    if (src_files != NULL && mode == TO_C) {
+        gen_c(src_files, out, unity);
+    } else if (src_files != NULL && mode == AST_PRINT) {
+        print_ast_files(src_files);
     } else {
-        invoke_gcc(src_files, gcc_args, gcc_args_tailp);
+        invoke_gcc(src_files, cc_args, cc_args_tailp, gcc_args,
+                gcc_args_tailp, cc_mode, out, other_input_files, use_pipe,
+                use_shards, unity);
     }
 
+    if (mem_stats)
+        print_mem_stats();
+
     arg_list_del(src_files);
     arg_list_del(gcc_args);
+    arg_list_del(cc_args);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "--server") == 0)
+        server_run(argv[2]);
+
+    // Let the compile server named by CZC_SERVER run the command line, if it
+    // is running.
+    const char *server = getenv("CZC_SERVER");
+    if (server != NULL && *server != '\0') {
+        int status = server_forward(server, argc, argv);
+        if (status >= 0)
+            return status;
+    }
+
+    return czc_main(argc, argv);
 }
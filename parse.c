@@ -1,18 +1,49 @@
 #include "zc.h"
 
-#define MAX_N_TOKENS 8192
+// Initial number of tokens in the token window.
+#define N_TOKENS_INIT 256
+
+// Files included in a translation unit, in the order they are included.
+struct included_files {
+    struct strmap *real_paths; // Canonical paths of the files included.
+    struct include_dep *deps;
+    size_t n_deps;
+    size_t max_deps;
+    bool lazy_bodies; // Leave the function bodies of the source files as
+                      // LAZY_BLOCK nodes.
+};
 
+// Parser context.  Tokens are read from the lexer when the parser needs them
+// and are kept in a window starting at the absolute position base.  Positions
+// before base have been released and cannot be revisited.
 struct parse {
     struct token {
         enum tok type;
         yylval_type val;
+        const char *src; // Source text and line the lexer started at.
+        int src_linenr;
     } *tokens;
-    struct strmap *included_files;
+    struct included_files *included_files;
+    struct ast **includes; // INCLUDE nodes for the files included.
+    size_t n_includes;
+    size_t max_includes;
+    struct lex_src src;
+    const char *src_cur;
+    unsigned file;
+    int linenr;
+    int base;
     int n_tokens;
+    int max_tokens;
     int pos;
     int nest_include_level;
+    bool lazy_bodies;
 };
 
+// Source texts of the LAZY_BLOCK nodes, kept until parse_release_lazy().
+static struct lex_src *lazy_srcs;
+static size_t n_lazy_srcs;
+static size_t max_lazy_srcs;
+
 enum {
     COMMA_PREC,     // ,
     ASGN_PREC,      // = += -= *= /= <<= &= etc.
@@ -30,7 +61,7 @@ enum {
     MEMBER_PREC     // .
 };
 
-struct ast *parse_with_include_map(const char *path, struct strmap
+struct ast *parse_with_include_map(const char *path, struct included_files
         *included_files, int nest_include_level);
 static struct ast *parse_binop_expr(struct parse *parse, int prec);
 static struct ast *parse_init(struct parse *parse);
@@ -41,79 +72,134 @@ static struct ast *parse_stmt_list(struct parse *parse);
 static struct ast *parse_stmt(struct parse *parse);
 static struct ast *term_semicolon(struct parse *parse, struct ast *ast);
 
-static struct parse *tokenize(const char *filepath)
+// Create a parser for the source text src of a file, starting at a line.
+static struct parse *parse_new_src(struct lex_src src, unsigned file,
+        int linenr)
 {
-    FILE *fp = fopen(filepath, "r"); 
-    if (!fp) {
+    struct parse *parse = malloc(sizeof *parse);
+    parse->src = src;
+    parse->src_cur = parse->src.data;
+    parse->file = file;
+    parse->linenr = linenr;
+    parse->tokens = malloc(N_TOKENS_INIT * sizeof *parse->tokens);
+    parse->max_tokens = N_TOKENS_INIT;
+    parse->base = 0;
+    parse->n_tokens = 0;
+    parse->pos = 0;
+    parse->includes = NULL;
+    parse->n_includes = 0;
+    parse->max_includes = 0;
+    parse->included_files = NULL;
+    parse->nest_include_level = 0;
+    parse->lazy_bodies = false;
+
+    return parse;
+}
+
+static struct parse *parse_new(const char *filepath)
+{
+    struct lex_src src;
+    if (!lex_src_open(&src, filepath)) {
         perror(filepath);
         exit(1);
     }
 
-    lex_filepath = strdup(filepath);
-    linenr = 1;
-    yyin = fp;
-
-    struct parse *parse = malloc(sizeof *parse);
-    parse->tokens = malloc(MAX_N_TOKENS * sizeof *parse->tokens);
-    parse->pos = 0;
-    parse->n_tokens = 0;
+    return parse_new_src(src, loc_file(filepath), 1);
+}
 
-    for (;;) {
-        if (parse->n_tokens >= MAX_N_TOKENS) {
-            fprintf(stderr, "error: too many tokens\n");
-            exit(1);
-        }
-        parse->tokens[parse->n_tokens].type = yylex();
-        parse->tokens[parse->n_tokens].val = yylval;
-        if (parse->tokens[parse->n_tokens++].type == EOF_TOK) {
-            break;
+// Read tokens from the lexer until the token at pos is in the window.
+static void fill_toks(struct parse *parse, int pos)
+{
+    // The lexer state is global, so restore the state for this file in case
+    // an included file has been lexed in between.
+    lex_cur = parse->src_cur;
+    lex_end = parse->src.data + parse->src.n;
+    lex_file = parse->file;
+    linenr = parse->linenr;
+
+    while (parse->base + parse->n_tokens <= pos) {
+        if (parse->n_tokens == parse->max_tokens) {
+            parse->max_tokens *= 2;
+            parse->tokens = realloc(parse->tokens, parse->max_tokens *
+                    sizeof *parse->tokens);
         }
+
+        struct token *tok = &parse->tokens[parse->n_tokens++];
+        tok->src = lex_cur;
+        tok->src_linenr = linenr;
+        tok->type = yylex();
+        tok->val = yylval;
     }
-    fclose(fp);
 
-    return parse;
+    parse->src_cur = lex_cur;
+    parse->linenr = linenr;
+}
+
+// Get reference to the token at absolute position pos.
+static struct token *tok_at(struct parse *parse, int pos)
+{
+    assert(pos >= parse->base);
+
+    if (pos >= parse->base + parse->n_tokens)
+        fill_toks(parse, pos);
+
+    return &parse->tokens[pos - parse->base];
+}
+
+// Free the value of a token.
+static void tok_del(struct token *tok)
+{
+    if (tok->type == STR_TOK)
+        free(tok->val.u.chars.s);
+}
+
+// Release the tokens before the current position.  The parser must not
+// backtrack to a position before the current one after calling this.
+static void release_toks(struct parse *parse)
+{
+    int n = parse->pos - parse->base;
+
+    for (int i = 0; i < n; ++i)
+        tok_del(&parse->tokens[i]);
+
+    parse->n_tokens -= n;
+    memmove(parse->tokens, parse->tokens + n, parse->n_tokens *
+            sizeof *parse->tokens);
+    parse->base = parse->pos;
 }
 
 // Get current line number.
-static struct loc *get_linenr(struct parse *parse)
+static loc_t get_linenr(struct parse *parse)
 {
-    return parse->tokens[parse->pos].val.linenr;
+    return tok_at(parse, parse->pos)->val.linenr;
 }
 
 // Get reference to the current token but do not consume it.
 static struct token *peek_tok(struct parse *parse)
 {
-    return &parse->tokens[parse->pos];
+    return tok_at(parse, parse->pos);
 }
 
 // Get reference to the current token and consume it.
 static struct token *get_tok(struct parse *parse)
 {
-    return &parse->tokens[parse->pos++];
+    return tok_at(parse, parse->pos++);
 }
 
-// Delete parser context information.
+// Delete parser context information.  The source text is not closed.
 static void parse_del(struct parse *parse)
 {
-    for (size_t i = 0; i < parse->n_tokens; ++i) {
-        switch (parse->tokens[i].type) {
-            case IDENT_TOK:
-            case STR_TOK:
-                free(parse->tokens[i].val.u.chars.s);
-        }
-    }
-    if (parse->nest_include_level == 0)
-        strmap_del(parse->included_files, NULL);
+    for (int i = 0; i < parse->n_tokens; ++i)
+        tok_del(&parse->tokens[i]);
     free(parse->tokens);
+    free(parse->includes);
     free(parse);
 }
 
 // Print syntax error message.
 static void syntax_error(struct parse *parse)
 {
-    struct loc *l = loc_ref(get_linenr(parse));
-    fatal(l, "invalid syntax");
-    loc_unref(l);
+    fatal(get_linenr(parse), "invalid syntax");
 }
 
 // Expect a token of type tok at the current parsing position.
@@ -192,14 +278,14 @@ static struct ast *parse_name(struct parse *parse)
     if (peek_tok(parse)->type != IDENT_TOK)
 	return NULL;
 
-    struct loc *line = get_linenr(parse);
-    return ast_new_s(line, NAME, strdup(get_tok(parse)->val.u.s));
+    loc_t line = get_linenr(parse);
+    return ast_new_s(line, NAME, get_tok(parse)->val.u.s);
 }
 
 // type_def : 'type' name type
 static struct ast *parse_type_def(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     expect(parse, TYPE_TOK);
 
     struct ast *name = parse_name(parse);
@@ -219,7 +305,7 @@ static struct ast *parse_alias_def(struct parse *parse)
     if (!expect(parse, DEFINE_TOK))
         return NULL;
 
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     struct ast *name = parse_name(parse);
     if (name == NULL)
         return NULL;
@@ -231,39 +317,68 @@ static struct ast *parse_alias_def(struct parse *parse)
     return term_semicolon(parse, ast_new_ast(line, ALIAS_DEF, 2, name, expr));
 }
 
+// Get the AST for an INCLUDE node.  Files are identified by their canonical
+// path, so a file included through different paths is only included once in a
+// translation unit.
+static struct ast *include_file(struct ast *include, struct included_files
+        *included_files, int nest_include_level)
+{
+    const char *path = ast_s(ast_ast(include, 0));
+
+    char *real_path = realpath(path, NULL);
+    if (real_path == NULL)
+        fatal(include->loc, "%s: %s", path, strerror(errno));
+
+    const char *real = atom_new(real_path);
+    free(real_path);
+
+    // Record the include.  The key of the content is set when the file is
+    // parsed.
+    if (included_files->n_deps == included_files->max_deps) {
+        included_files->max_deps = included_files->max_deps ?
+            included_files->max_deps * 2 : 8;
+        included_files->deps = realloc(included_files->deps,
+                included_files->max_deps * sizeof *included_files->deps);
+    }
+    included_files->deps[included_files->n_deps++] =
+        (struct include_dep){ path, real };
+
+    if (strmap_get(included_files->real_paths, real) != NULL)
+        return ast_new(include->loc, ALREADY_INCLUDED);
+
+    strmap_add(included_files->real_paths, real, (void *)0x1234);
+    return parse_with_include_map(path, included_files, nest_include_level);
+}
+
 // include : 'include' str_lit
 static struct ast *parse_include(struct parse *parser)
 {
+    loc_t line = get_linenr(parser);
+
     if (!expect(parser, INCLUDE_TOK))
         return NULL;
 
     if (peek_tok(parser)->type != STR_TOK)
         return NULL;;
 
-    const char *path = get_tok(parser)->val.u.chars.s;
+    const char *path = atom_new(get_tok(parser)->val.u.chars.s);
 
     if (!expect(parser, ';'))
         return NULL;
 
-    // include file
-    if (strmap_get(parser->included_files, path) == NULL) {
-        FILE *fp = fopen(path, "r");
-        if (fp == NULL) {
-            struct loc *loc = loc_ref(get_linenr(parser));
-            fatal(loc, "%s: %s", path, strerror(errno));
-            loc_unref(loc);
-        }
+    struct ast *include = ast_new_ast(line, INCLUDE, 1,
+            ast_new_s(line, NAME, path));
 
-        struct ast *ast = parse_with_include_map(path, parser->included_files,
-                parser->nest_include_level + 1);
-
-        strmap_add(parser->included_files, path, (void *)0x1234);
-
-        fclose(fp);
-        return ast;
+    if (parser->n_includes == parser->max_includes) {
+        parser->max_includes = parser->max_includes ? parser->max_includes * 2
+            : 8;
+        parser->includes = realloc(parser->includes, parser->max_includes *
+                sizeof *parser->includes);
     }
+    parser->includes[parser->n_includes++] = include;
 
-    return ast_new(get_linenr(parser), ALREADY_INCLUDED);
+    return include_file(include, parser->included_files,
+            parser->nest_include_level + 1);
 }
 
 
@@ -278,7 +393,7 @@ static struct ast *parse_asgn_expr(struct parse *parse)
  */
 static struct ast *parse_expr_list(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     return ast_new_list(line, EXPR_LIST, parse_list(parse, ',', parse_asgn_expr));
 }
 
@@ -289,10 +404,10 @@ static struct ast *parse_expr_list(struct parse *parse)
  */
 static struct ast *parse_primary_expr(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     switch (peek_tok(parse)->type) {
         case IDENT_TOK: {
-            char *ident = get_tok(parse)->val.u.s;
+            const char *ident = get_tok(parse)->val.u.s;
 
             struct ast *name = ast_new_s(line, NAME, ident);
 
@@ -353,7 +468,7 @@ static struct ast *parse_postfix_expr(struct parse *parse)
         return expr;
 
     for (;;) {
-	struct loc *line = get_linenr(parse);
+	loc_t line = get_linenr(parse);
         switch (peek_tok(parse)->type) {
             case DEC_TOK: {
                 parse->pos++;
@@ -407,6 +522,32 @@ err:
     return NULL;
 }
 
+static struct ast *parse_unary_expr(struct parse *parse);
+
+/* offsetof_expr : 'offsetof' ident postfix_expr_tail
+ *
+ * offsetof is not reserved, so programs can use it as a name.  It is only taken
+ * as the operator when it is followed by a name and the operand is a member
+ * access.  Otherwise NULL is returned without consuming any tokens.
+ */
+static struct ast *parse_offsetof_expr(struct parse *parse)
+{
+    int pos = parse->pos;
+    if (get_tok(parse)->val.u.s != atom_new("offsetof") ||
+            peek_tok(parse)->type != IDENT_TOK) {
+        parse->pos = pos;
+        return NULL;
+    }
+
+    struct ast *ast = parse_unary_expr(parse);
+    if (ast == NULL || ast->tag != MEMBER_EXPR) {
+        parse->pos = pos;
+        return NULL;
+    }
+
+    return ast_new_ast(get_linenr(parse), OFFSETOF_EXPR, 1, ast);
+}
+
 /* unary_expr : postfix_expr
  *            | '-' unary_expr
  *            | '+' unary_expr
@@ -414,10 +555,11 @@ err:
  *            | '~' unary_expr
  *            | '^' unary_expr
  *            | 'sizeof' unary_expr
+ *            | offsetof_expr
  */
 static struct ast *parse_unary_expr(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     enum ast_tag op = INVALID_AST_TAG;
 
     switch (peek_tok(parse)->type) {
@@ -453,6 +595,11 @@ static struct ast *parse_unary_expr(struct parse *parse)
             op = SIZEOF_EXPR;
             break;
 
+        case IDENT_TOK: {
+            struct ast *ast = parse_offsetof_expr(parse);
+            return ast != NULL ? ast : parse_postfix_expr(parse);
+        }
+
         default:
             return parse_postfix_expr(parse);
     }
@@ -474,7 +621,7 @@ static struct ast *parse_cast_expr(struct parse *parse)
     if (expr == NULL)
         goto err0;
 
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     if (peek_tok(parse)->type == AS_TOK) {
         parse->pos++;
         struct ast *type = parse_type(parse);
@@ -517,7 +664,7 @@ static struct ast *parse_binop_expr(struct parse *parse, int prec)
         enum ast_tag op;
         int rprec, next_prec;
 
-	struct loc *line = get_linenr(parse);
+	loc_t line = get_linenr(parse);
         switch (peek_tok(parse)->type) {
             case ',':
                 op = COMMA_EXPR;
@@ -741,7 +888,7 @@ static struct ast *parse_expr(struct parse *parse)
 
 static struct ast *parse_case(struct parse *parse)
 {
-    struct loc *linenr = get_linenr(parse);
+    loc_t linenr = get_linenr(parse);
 
     switch (peek_tok(parse)->type) {
         case CASE_TOK: {
@@ -780,7 +927,7 @@ static struct ast *parse_case_list(struct parse *parse)
     struct ast_list *head = NULL;
     struct ast_list **tailp = &head;
 
-    struct loc *linenr = get_linenr(parse);
+    loc_t linenr = get_linenr(parse);
 
     for (;;) {
         int pos = parse->pos;
@@ -807,7 +954,7 @@ static struct ast *parse_switch_stmt(struct parse *parse)
     if (!expect(parse, SWITCH_TOK))
         goto err0;
 
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     struct ast *expr = parse_expr(parse);
     if (expr == NULL)
         goto err0;
@@ -825,9 +972,9 @@ static struct ast *parse_switch_stmt(struct parse *parse)
     return ast_new_ast(line, SWITCH_STMT, 2, expr, block);
 
 err2:
-    free(block);
+    ast_unref(block);
 err1:
-    free(expr);
+    ast_unref(expr);
 err0:        
     return NULL;
 }
@@ -841,7 +988,7 @@ static struct ast *parse_if_stmt(struct parse *parse)
     if (!expect(parse, IF_TOK))
         goto err0;
 
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
 
     struct ast *expr = NULL;
     if (peek_tok(parse)->type != '{') {
@@ -883,7 +1030,7 @@ static struct ast *parse_for_stmt(struct parse *parse)
     if (!expect(parse, FOR_TOK))
         return NULL;
 
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
 
     struct ast *expr0 = NULL;
     struct ast *expr1 = NULL;
@@ -927,7 +1074,7 @@ err:
  */
 static struct ast *parse_label_stmt(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     struct ast *name = parse_name(parse);
     if (name == NULL)
         return NULL;
@@ -948,7 +1095,7 @@ static struct ast *parse_goto_stmt(struct parse *parse)
     if (!expect(parse, GOTO_TOK))
         return NULL;
 
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
 
     struct ast *name = parse_name(parse);
     if (name == NULL)
@@ -967,7 +1114,7 @@ static struct ast *parse_goto_stmt(struct parse *parse)
  */
 static struct ast *parse_stmt(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     switch (peek_tok(parse)->type)
     {
         case IF_TOK:
@@ -1024,9 +1171,9 @@ static struct ast *parse_stmt(struct parse *parse)
  */
 static struct ast *parse_param(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     if (peek_tok(parse)->type == IDENT_TOK) {
-        struct ast *name = ast_new_s(line, NAME, strdup(get_tok(parse)->val.u.s));
+        struct ast *name = ast_new_s(line, NAME, get_tok(parse)->val.u.s);
 
         int pos = parse->pos;
         struct ast *type = parse_type(parse);
@@ -1083,7 +1230,7 @@ static struct ast *parse_param_list(struct parse *parse)
         parse->pos++;
     }
 
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
 
     if (peek_tok(parse)->type == ELLIPSIS_TOK) {
         *tailp = ast_list_new(ast_new(get_linenr(parse), VARARG_TYPE));
@@ -1099,7 +1246,7 @@ static struct ast *parse_param_list(struct parse *parse)
 static struct ast *parse_decl_list(struct parse *parse)
 {
     struct ast_list **tailp, *head = parse_list(parse, ',', parse_decl);
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
 
     return ast_new_list(line, STRUCT_EXPR, head);
 }
@@ -1111,7 +1258,7 @@ static struct ast *parse_decl_list(struct parse *parse)
  */
 static struct ast *parse_type(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     switch (peek_tok(parse)->type) {
         case '^': {
             parse->pos++;
@@ -1148,7 +1295,7 @@ static struct ast *parse_type(struct parse *parse)
             return ast_new_ast(line, FUNC_EXPR, 2, param_list, type);
         }
         case IDENT_TOK: {
-            char *s = parse->tokens[parse->pos++].val.u.s;
+            const char *s = get_tok(parse)->val.u.s;
             return ast_new_s(line, NAME, s);
         }
         case '{': {
@@ -1177,7 +1324,7 @@ static struct ast *term_semicolon(struct parse *parse, struct ast *ast)
 
 static struct ast *parse_stmt_list(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     return ast_new_list(line, STMT_LIST, parse_list(parse, -1, parse_stmt));
 }
 
@@ -1190,7 +1337,7 @@ static struct ast *parse_block(struct parse *parse)
 
 static struct ast *parse_init_list(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     return ast_new_list(line, INIT_EXPR, parse_list(parse, ',', parse_init));
 }
 
@@ -1203,9 +1350,32 @@ static struct ast *parse_init(struct parse *parse)
         return parse_asgn_expr(parse);
 }
 
+// Skip a function body, and get a LAZY_BLOCK node with its source text, which
+// is parsed by parse_lazy_block().  Only the braces are matched here, the rest
+// of the syntax is checked when the body is parsed.
+static struct ast *skip_block(struct parse *parse)
+{
+    struct token *tok = peek_tok(parse);
+    const char *start = tok->src;
+    loc_t loc = loc_new(parse->file, tok->src_linenr);
+    int depth = 0;
+
+    do {
+        enum tok type = peek_tok(parse)->type;
+        if (type == EOF_TOK)
+            syntax_error(parse);
+
+        parse->pos++;
+        depth += type == '{' ? 1 : type == '}' ? -1 : 0;
+    } while (depth > 0);
+
+    const char *end = peek_tok(parse)->src;
+    return ast_new_chars_ref(loc, LAZY_BLOCK, start, end - start);
+}
+
 static struct ast *parse_decl_or_def(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     struct ast *name = ast_new_s(line, NAME, get_tok(parse)->val.u.s);
 
     bool is_func = peek_tok(parse)->type == '(';
@@ -1217,8 +1387,11 @@ static struct ast *parse_decl_or_def(struct parse *parse)
 
     struct ast *decl = ast_new_ast(line, DECL, 2, name, type);
 
-    if (is_func && peek_tok(parse)->type == '{')
-        return ast_new_ast(line, FUNC_DEF, 2, decl, parse_block(parse));
+    if (is_func && peek_tok(parse)->type == '{') {
+        struct ast *block = parse->lazy_bodies ? skip_block(parse) :
+            parse_block(parse);
+        return ast_new_ast(line, FUNC_DEF, 2, decl, block);
+    }
 
     if (peek_tok(parse)->type == ';') {
         return term_semicolon(parse, decl);
@@ -1242,7 +1415,7 @@ static struct ast *parse_decl_or_def(struct parse *parse)
  */
 static struct ast *parse_extern_def(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
+    loc_t line = get_linenr(parse);
     switch (peek_tok(parse)->type) {
         case IDENT_TOK:
             return parse_decl_or_def(parse);
@@ -1262,29 +1435,152 @@ static struct ast *parse_extern_def(struct parse *parse)
  */
 struct ast *parse_program(struct parse *parse)
 {
-    struct loc *line = get_linenr(parse);
-    struct ast_list *extern_def_list = parse_list(parse, -1, parse_extern_def);
+    struct ast_list *head = NULL;
+    struct ast_list **tailp = &head;
+
+    loc_t line = get_linenr(parse);
+
+    // The parser never backtracks past the start of an external definition,
+    // so the tokens of each definition are released after it is parsed.
+    for (;;) {
+        int pos = parse->pos;
+        struct ast *ast = parse_extern_def(parse);
+        if (ast == NULL) {
+            parse->pos = pos;
+            break;
+        }
+
+        *tailp = ast_list_new(ast);
+        tailp = &(*tailp)->next;
+
+        release_toks(parse);
+    }
 
     if (peek_tok(parse)->type != EOF_TOK)
         syntax_error(parse);
 
-    return ast_new_list(line, SOURCE_FILE, extern_def_list);
+    return ast_new_list(line, SOURCE_FILE, head);
 }
 
-struct ast *parse_with_include_map(const char *path, struct strmap
+struct ast *parse_with_include_map(const char *path, struct included_files
         *included_files, int nest_include_lev)
 {
-    struct parse *parse = tokenize(path);
+    struct parse *parse = parse_new(path);
     parse->included_files = included_files;
     parse->nest_include_level = nest_include_lev;
-    struct ast *ast = parse_program(parse);
+    parse->lazy_bodies = included_files->lazy_bodies && nest_include_lev == 0;
+
+    // The ASTs of included files are cached on disk, keyed by the content of
+    // the file.  The files it includes are not part of a cached AST, as they
+    // can already have been included.
+    uint64_t key = 0;
+    if (nest_include_lev > 0) {
+        key = cache_key(parse->src.data, parse->src.n);
+
+        // The file is the one last recorded by include_file().
+        struct include_dep *dep =
+            &included_files->deps[included_files->n_deps - 1];
+        dep->key = key;
+        if (key != 0)
+            sha256(parse->src.data, parse->src.n, dep->digest);
+    }
+
+    // A compile server can have the AST already loaded.
+    struct ast *ast = NULL;
+    if (key != 0) {
+        const char *real_path =
+            included_files->deps[included_files->n_deps - 1].real_path;
+        ast = server_load_ast(real_path, key, parse->file);
+        if (ast == NULL)
+            ast = cache_load_ast(key, parse->file);
+        cache_count(ast != NULL ? CACHE_INCLUDE_HIT : CACHE_INCLUDE_MISS);
+    }
+
+    if (ast != NULL) {
+        size_t n_childs;
+        struct ast **childs = ast_asts(ast, &n_childs);
+
+        for (size_t i = 0; i < n_childs; ++i) {
+            if (childs[i]->tag == INCLUDE)
+                childs[i] = include_file(childs[i], included_files,
+                        nest_include_lev + 1);
+        }
+    } else {
+        ast = parse_program(parse);
+        if (key != 0)
+            cache_store_ast(key, ast, parse->includes, parse->n_includes);
+    }
+
+    // The source text of the function bodies is kept until they are parsed.
+    if (parse->lazy_bodies) {
+        if (n_lazy_srcs == max_lazy_srcs) {
+            max_lazy_srcs = max_lazy_srcs ? max_lazy_srcs * 2 : 4;
+            lazy_srcs = realloc(lazy_srcs, max_lazy_srcs * sizeof *lazy_srcs);
+        }
+        lazy_srcs[n_lazy_srcs++] = parse->src;
+    } else {
+        lex_src_close(&parse->src);
+    }
 
     parse_del(parse);
 
     return ast;
 }
 
-struct ast *parse(const char *path)
+struct ast *parse(const char *path, struct include_dep **deps, size_t *n_deps)
+{
+    return parse_unity(&path, 1, false, deps, n_deps);
+}
+
+struct ast *parse_unity(const char **paths, size_t n_paths, bool lazy_bodies,
+        struct include_dep **deps, size_t *n_deps)
+{
+    struct included_files included_files = {
+        strmap_new(0), NULL, 0, 0, lazy_bodies
+    };
+    struct ast *ast;
+    if (n_paths == 1) {
+        ast = parse_with_include_map(paths[0], &included_files, 0);
+    } else {
+        ast = ast_new_n(NO_LOC, SOURCE_FILE, n_paths);
+        size_t n_childs;
+        struct ast **childs = ast_asts(ast, &n_childs);
+        for (size_t i = 0; i < n_paths; i++)
+            childs[i] = parse_with_include_map(paths[i], &included_files, 0);
+    }
+
+    strmap_del(included_files.real_paths, NULL);
+    server_report_includes(included_files.deps, included_files.n_deps);
+
+    if (deps != NULL) {
+        *deps = included_files.deps;
+        *n_deps = included_files.n_deps;
+    } else {
+        free(included_files.deps);
+    }
+
+    return ast;
+}
+
+struct ast *parse_lazy_block(struct ast *ast)
+{
+    size_t n;
+    const char *s = ast_chars(ast, &n);
+    struct lex_src src = { (char *)s, n, false };
+    struct parse *parse = parse_new_src(src, loc_file_idx(ast->loc),
+            loc_line(ast->loc));
+
+    struct ast *block = parse_block(parse);
+    if (peek_tok(parse)->type != EOF_TOK)
+        syntax_error(parse);
+
+    parse_del(parse);
+    return block;
+}
+
+void parse_release_lazy(void)
 {
-    return parse_with_include_map(path, strmap_new(1024), 0);
+    for (size_t i = 0; i < n_lazy_srcs; i++)
+        lex_src_close(&lazy_srcs[i]);
+    n_lazy_srcs = 0;
 }
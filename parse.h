@@ -1,6 +1,32 @@
 #ifndef PARSE_H
 #define PARSE_H
 
-struct ast *parse(const char *path);
+// A file included by a translation unit.
+struct include_dep {
+    const char *path;      // Path in the include statement.
+    const char *real_path; // Canonical path of the file.
+    uint64_t key;          // Cache key of the content, or zero if the file was
+                           // already included or the cache is disabled.
+    unsigned char digest[SHA256_SIZE]; // SHA-256 of the content, if key is set.
+};
+
+// Parse a source file.  If deps is not NULL, the files included by it, directly
+// or indirectly, are returned in an array allocated with malloc.
+struct ast *parse(const char *path, struct include_dep **deps, size_t *n_deps);
+
+// Parse source files as one translation unit, in which a file included by more
+// than one of them is only included once.  If there is more than one file, the
+// AST has no location and the SOURCE_FILE of each file as a child.  With
+// lazy_bodies, the bodies of the functions in the source files, but not in the
+// files they include, are left as LAZY_BLOCK nodes.
+struct ast *parse_unity(const char **paths, size_t n_paths, bool lazy_bodies,
+        struct include_dep **deps, size_t *n_deps);
+
+// Parse the function body of a LAZY_BLOCK node in the current arena.
+struct ast *parse_lazy_block(struct ast *ast);
+
+// Release the source text of the LAZY_BLOCK nodes, which cannot be parsed after
+// this.
+void parse_release_lazy(void);
 
 #endif /* !defined PARSE_H */
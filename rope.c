@@ -36,6 +36,7 @@ struct rope sp_rope[1] = { { .leaf = true, .val.s =  " " } };
 struct rope nl_rope[1] = { { .leaf = true, .val.s =  "\n" } };
 struct rope semi_nl_rope[1] = { { .leaf = true, .val.s =  ";\n" } };
 struct rope extern_sp_rope[1] = { { .leaf = true, .val.s =  "extern " } };
+struct rope static_inline_sp_rope[1] = { { .leaf = true, .val.s =  "static inline " } };
 struct rope struct_sp_rope[1] = { { .leaf = true, .val.s =  "struct " } };
 struct rope dot_rope[1] = { { .leaf = true, .val.s =  "." } };
 struct rope one_rope[1] = { { .leaf = true, .val.s =  "1" } };
@@ -86,26 +87,14 @@ struct rope default_colon_nl_rope[1] = { { .leaf = true, .val.s = "default:\n" }
 struct rope colon_nl_rope[1] = { { .leaf = true, .val.s = ":\n" } };
 struct rope goto_sp_rope[1] = { { .leaf = true, .val.s = "goto " } };
 
-static struct {
-    char data[1 << 20];
-    size_t n;
-} rope_buf;
-
 struct rope *rope_indent(void)
 {
-    struct rope *rope = malloc(sizeof *rope);
+    struct rope *rope = arena_alloc(zc_arena, sizeof *rope);
     rope->leaf = true;
-    rope->val.s = rope_buf.data + rope_buf.n;
-    
-    size_t i = 0;
-    while (i < zc_indent_level) {
-        for (size_t j = 0; j < 4; ++j) {
-            rope->val.s[i++] = ' ';
-            rope_buf.n += 4;
-        }
-    }
-    rope->val.s[i] = '\0';
-    rope_buf.n++;
+    char *s = arena_alloc(zc_arena, zc_indent_level * 4 + 1);
+    memset(s, ' ', zc_indent_level * 4);
+    s[zc_indent_level * 4] = '\0';
+    rope->val.s = s;
 
     return rope;
 }
@@ -116,37 +105,49 @@ struct rope *rope_line(struct rope *rope)
     return rope_new_tree(rope, rope_new_s("\n"));
 }
 
+// Create a leaf with formatted text.  The text is stored in the current arena.
 struct rope *rope_new_fmt(const char *fmt, ...)
 {
-    struct rope *rope = malloc(sizeof *rope);
+    struct rope *rope = arena_alloc(zc_arena, sizeof *rope);
     rope->leaf = true;
-    rope->val.s = rope_buf.data + rope_buf.n;
 
-    va_list va;
+    va_list va, va2;
     va_start(va, fmt);
+    va_copy(va2, va);
 
-    char *data = rope_buf.data + rope_buf.n;
-    size_t n_left = sizeof rope_buf.data - rope_buf.n;
+    // Most text is short, so format into a buffer on the stack to avoid
+    // formatting twice.
+    char buf[128];
+    size_t n = vsnprintf(buf, sizeof buf, fmt, va) + 1;
+    char *s = arena_alloc(zc_arena, n);
 
-    size_t n_written = vsnprintf(data, n_left, fmt, va) + 1;
-    if (n_written > n_left)
-        fatal(NULL, "not enough space in rope buffer");
+    if (n <= sizeof buf)
+        memcpy(s, buf, n);
+    else
+        vsnprintf(s, n, fmt, va2);
 
-    rope_buf.n += n_written;
+    rope->val.s = s;
 
+    va_end(va2);
     va_end(va);
 
     return rope;
 }
 
+// Create a leaf referencing the string s.  The string is not copied, so it
+// must not change and has to live as long as the rope.
 struct rope *rope_new_s(const char *s)
 {
-    return rope_new_fmt("%s", s);
+    struct rope *rope = arena_alloc(zc_arena, sizeof *rope);
+    rope->leaf = true;
+    rope->val.s = s;
+
+    return rope;
 }
 
 struct rope *rope_new_tree(struct rope *left, struct rope *right)
 {
-    struct rope *rope = malloc(sizeof *rope);
+    struct rope *rope = arena_alloc(zc_arena, sizeof *rope);
     rope->leaf = false;
     rope->val.childs[0] = left;
     rope->val.childs[1] = right;
@@ -154,18 +155,198 @@ struct rope *rope_new_tree(struct rope *left, struct rope *right)
     return rope;
 }
 
+// Initial size of the stack used when iterating over the leaves of a rope.
+#define N_ROPE_STACK_INIT 64
+
+// Leaves shorter than this are copied into the output buffer by
+// rope_print_to_file().  Longer leaves are written directly from the rope.
+#define MAX_COPIED_LEAF 512
+
+// Size of the output buffer of rope_print_to_file().
+#define ROPE_OUT_BUF_SIZE 65536
+
+// Maximum number of buffers written by one writev() call.
+#define N_ROPE_IOVECS 256
+
+// Iterator over the leaves of a rope.  It uses a stack of the subtrees left to
+// visit rather than recursion, since ropes built by appending one node at a
+// time are as deep as they are long.
+struct rope_iter {
+    struct rope **stack;
+    size_t n;
+    size_t max_n;
+};
+
+static void rope_iter_init(struct rope_iter *iter, struct rope *rope)
+{
+    iter->stack = malloc(N_ROPE_STACK_INIT * sizeof *iter->stack);
+    iter->max_n = N_ROPE_STACK_INIT;
+    iter->n = 0;
+
+    if (rope)
+        iter->stack[iter->n++] = rope;
+}
+
+// Get the next leaf, or NULL after the last leaf.
+static struct rope *rope_iter_next(struct rope_iter *iter)
+{
+    while (iter->n > 0) {
+        struct rope *rope = iter->stack[--iter->n];
+
+        while (!rope->leaf) {
+            struct rope *left = rope->val.childs[0];
+            struct rope *right = rope->val.childs[1];
+
+            if (right) {
+                if (iter->n == iter->max_n) {
+                    iter->max_n *= 2;
+                    iter->stack = realloc(iter->stack, iter->max_n *
+                            sizeof *iter->stack);
+                }
+                iter->stack[iter->n++] = right;
+            }
+
+            if (!left)
+                break;
+
+            rope = left;
+        }
+
+        if (rope->leaf)
+            return rope;
+    }
+
+    return NULL;
+}
+
+static void rope_iter_del(struct rope_iter *iter)
+{
+    free(iter->stack);
+}
+
+// Get the length of the text in a rope.
+size_t rope_len(struct rope *rope)
+{
+    size_t n = 0;
+
+    struct rope_iter iter;
+    rope_iter_init(&iter, rope);
+
+    struct rope *leaf;
+    while ((leaf = rope_iter_next(&iter)) != NULL)
+        n += strlen(leaf->val.s);
+
+    rope_iter_del(&iter);
+    return n;
+}
+
+// Create a leaf with the text of a rope.  The leaf does not reference the nodes
+// of the rope, so they can be freed afterwards.
+struct rope *rope_flatten(struct rope *rope)
+{
+    char *s = arena_alloc(zc_arena, rope_len(rope) + 1);
+    char *dst = s;
+
+    struct rope_iter iter;
+    rope_iter_init(&iter, rope);
+
+    struct rope *leaf;
+    while ((leaf = rope_iter_next(&iter)) != NULL) {
+        size_t n = strlen(leaf->val.s);
+        memcpy(dst, leaf->val.s, n);
+        dst += n;
+    }
+    *dst = '\0';
+
+    rope_iter_del(&iter);
+
+    struct rope *flat = arena_alloc(zc_arena, sizeof *flat);
+    flat->leaf = true;
+    flat->val.s = s;
+
+    return flat;
+}
+
+// Write all buffers in iov to file descriptor fd.
+static void write_iovecs(int fd, struct iovec *iov, int n_iov)
+{
+    while (n_iov > 0) {
+        ssize_t n = writev(fd, iov, n_iov);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            // The reader of a pipe has exited.  This is reported by the
+            // reader, like GCC reading the generated code.
+            if (errno == EPIPE)
+                return;
+            fatal(NO_LOC, "write: %s", strerror(errno));
+        }
+
+        // Skip the buffers which got written, in case of a partial write.
+        while (n_iov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+        if (n_iov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Write the text of a rope to a file.  Short leaves are gathered in a buffer
+// and long leaves are written directly from the rope, all with one writev()
+// call per batch.
 void rope_print_to_file(struct rope *rope, FILE *fp)
 {
-    if (!rope)
-        return;
+    static char buf[ROPE_OUT_BUF_SIZE];
+    size_t buf_n = 0;
+    struct iovec iov[N_ROPE_IOVECS];
+    int n_iov = 0;
+
+    // Text already written to the stream has to come first.
+    fflush(fp);
+    int fd = fileno(fp);
 
-    if (rope->leaf) {
-        fputs(rope->val.s, fp);
-        return;
+    struct rope_iter iter;
+    rope_iter_init(&iter, rope);
+
+    struct rope *leaf;
+    while ((leaf = rope_iter_next(&iter)) != NULL) {
+        const char *s = leaf->val.s;
+        size_t n = strlen(s);
+
+        if (n == 0)
+            continue;
+
+        if (n_iov == N_ROPE_IOVECS ||
+                (n < MAX_COPIED_LEAF && buf_n + n > sizeof buf)) {
+            write_iovecs(fd, iov, n_iov);
+            n_iov = 0;
+            buf_n = 0;
+        }
+
+        if (n < MAX_COPIED_LEAF) {
+            char *dst = buf + buf_n;
+            memcpy(dst, s, n);
+            buf_n += n;
+
+            // Extend the last buffer if it ends where this text was copied.
+            if (n_iov > 0 && (char *)iov[n_iov - 1].iov_base +
+                    iov[n_iov - 1].iov_len == dst) {
+                iov[n_iov - 1].iov_len += n;
+                continue;
+            }
+            iov[n_iov].iov_base = dst;
+        } else {
+            iov[n_iov].iov_base = (char *)s;
+        }
+        iov[n_iov++].iov_len = n;
     }
 
-    rope_print_to_file(rope->val.childs[0], fp);
-    rope_print_to_file(rope->val.childs[1], fp);
+    write_iovecs(fd, iov, n_iov);
+    rope_iter_del(&iter);
 }
 
 void rope_print(struct rope *rope)
@@ -5,7 +5,7 @@
 struct rope {
     bool leaf;
     union {
-        char *s;
+        const char *s;
         struct rope *childs[2];
     } val;
 };
@@ -46,6 +46,7 @@ extern struct rope sp_rope[1];
 extern struct rope nl_rope[1];
 extern struct rope semi_nl_rope[1];
 extern struct rope extern_sp_rope[1];
+extern struct rope static_inline_sp_rope[1];
 extern struct rope struct_sp_rope[1];
 extern struct rope dot_rope[1];
 extern struct rope one_rope[1];
@@ -101,6 +102,8 @@ struct rope *rope_new_s(const char *s);
 struct rope *rope_new_fmt(const char *fmt, ...);
 
 struct rope *rope_new_tree(struct rope *left, struct rope *right);
+size_t rope_len(struct rope *rope);
+struct rope *rope_flatten(struct rope *rope);
 void rope_print(struct rope *rope);
 void rope_print_to_file(struct rope *rope, FILE *fp);
 
@@ -1,33 +1,163 @@
 #include "zc.h"
 
-struct scope *scope_new(struct scope *parent, size_t n_syms, size_t n_types)
+// Initial size of the undo log and the stack of marks.
+#define N_SCOPE_LOG_INIT 64
+#define N_SCOPE_MARKS_INIT 16
+
+// Binding of a name to a symbol in a scope.
+struct binding {
+    const char *name;
+    struct sym *sym;
+    struct strmap *map;         // The table the name is bound in.
+    struct binding *shadowed;   // Binding restored when this one is removed.
+    unsigned level;             // Level of the scope it was added in.
+};
+
+// The last value given to zc_scope_gen by any thread.  The values are unique
+// across the threads, so a type cached by one thread in a node shared with other
+// threads is never taken as valid by them.
+static unsigned last_scope_gen = 1;
+
+// Give zc_scope_gen a new value.
+void scope_new_gen(void)
+{
+    zc_scope_gen = __atomic_add_fetch(&last_scope_gen, 1, __ATOMIC_RELAXED);
+}
+
+struct scope *scope_new(void)
 {
     struct scope *scope = malloc(sizeof *scope);
-    scope->symtbl = strmap_new(n_syms);
-    scope->typetbl = strmap_new(n_types);
-    scope->parent = parent;
+    scope->symtbl = strmap_new(0);
+    scope->typetbl = strmap_new(0);
+    scope->log = malloc(N_SCOPE_LOG_INIT * sizeof *scope->log);
+    scope->n_log = 0;
+    scope->max_log = N_SCOPE_LOG_INIT;
+    scope->marks = malloc(N_SCOPE_MARKS_INIT * sizeof *scope->marks);
+    scope->n_marks = 0;
+    scope->max_marks = N_SCOPE_MARKS_INIT;
+    scope->free_bindings = NULL;
     return scope;
 }
 
+void scope_del(struct scope *scope)
+{
+    for (size_t i = 0; i < scope->n_log; i++)
+        free(scope->log[i]);
+
+    while (scope->free_bindings != NULL) {
+        struct binding *next = scope->free_bindings->shadowed;
+        free(scope->free_bindings);
+        scope->free_bindings = next;
+    }
+
+    strmap_del(scope->symtbl, NULL);
+    strmap_del(scope->typetbl, NULL);
+    free(scope->log);
+    free(scope->marks);
+    free(scope);
+}
+
+// Create a scope with the bindings of another scope.  The bindings of the
+// scope copied from are shared, so it can be used by other threads as long as
+// they are not changed.
+struct scope *scope_copy(struct scope *scope)
+{
+    struct scope *copy = scope_new();
+    strmap_del(copy->symtbl, NULL);
+    strmap_del(copy->typetbl, NULL);
+    copy->symtbl = strmap_copy(scope->symtbl);
+    copy->typetbl = strmap_copy(scope->typetbl);
+
+    // The copy has no bindings of its own to undo.
+    while (copy->n_marks < scope->n_marks)
+        scope_push(copy);
+
+    return copy;
+}
+
+void scope_push(struct scope *scope)
+{
+    if (scope->n_marks == scope->max_marks) {
+        scope->max_marks *= 2;
+        scope->marks = realloc(scope->marks, scope->max_marks *
+                sizeof *scope->marks);
+    }
+
+    scope->marks[scope->n_marks++] = scope->n_log;
+    scope_new_gen();
+}
+
+void scope_pop(struct scope *scope)
+{
+    assert(scope->n_marks > 0);
+    size_t mark = scope->marks[--scope->n_marks];
+
+    // Undo the bindings in reverse order, so a name bound more than once in
+    // the scope gets back its binding from before the scope.
+    while (scope->n_log > mark) {
+        struct binding *b = scope->log[--scope->n_log];
+        strmap_add(b->map, b->name, b->shadowed);
+
+        b->shadowed = scope->free_bindings;
+        scope->free_bindings = b;
+    }
+
+    scope_new_gen();
+}
+
+static void add_binding(struct scope *scope, struct strmap *map,
+        const char *name, struct sym *sym)
+{
+    struct binding *b = scope->free_bindings;
+    if (b != NULL)
+        scope->free_bindings = b->shadowed;
+    else
+        b = malloc(sizeof *b);
+
+    b->name = name;
+    b->sym = sym;
+    b->map = map;
+    b->shadowed = strmap_get(map, name);
+    b->level = scope_level(scope);
+    strmap_add(map, name, b);
+
+    if (scope->n_log == scope->max_log) {
+        scope->max_log *= 2;
+        scope->log = realloc(scope->log, scope->max_log * sizeof *scope->log);
+    }
+    scope->log[scope->n_log++] = b;
+
+    scope_new_gen();
+}
+
 void scope_add_sym(struct scope *scope, const char *name, struct sym *sym)
 {
-    strmap_add(scope->symtbl, name, sym);
+    add_binding(scope, scope->symtbl, name, sym);
 }
 
 void scope_add_typesym(struct scope *scope, const char *name, struct sym *sym)
 {
-    strmap_add(scope->typetbl, name, sym);
+    add_binding(scope, scope->typetbl, name, sym);
 }
 
 struct sym *scope_get_sym(struct scope *scope, const char *name)
 {
-    struct sym *sym = strmap_get(scope->symtbl, name);
-    if (sym == NULL) {
-        if (scope->parent == NULL)
-            return NULL;
-        return scope_get_sym(scope->parent, name);
-    }
-    return sym_res(sym);
+    struct binding *b = strmap_get(scope->symtbl, name);
+    if (b == NULL)
+        return NULL;
+    return sym_res(b->sym);
+}
+
+// Get a symbol ignoring any local symbols shadowing it.
+struct sym *scope_get_global_sym(struct scope *scope, const char *name)
+{
+    struct binding *b = strmap_get(scope->symtbl, name);
+    while (b != NULL && b->level > GLOBAL_SCOPE_LEVEL)
+        b = b->shadowed;
+
+    if (b == NULL)
+        return NULL;
+    return sym_res(b->sym);
 }
 
 struct type *sym_type(struct sym * sym)
@@ -41,11 +171,8 @@ struct type *sym_type(struct sym * sym)
 
 struct type *scope_get_type(struct scope *scope, const char *name)
 {
-    struct sym *sym = strmap_get(scope->typetbl, name);
-    if (sym == NULL) {
-        if (scope->parent == NULL)
-            return NULL;
-        return scope_get_type(scope->parent, name);
-    }
-    return sym_type(sym_res(sym));
+    struct binding *b = strmap_get(scope->typetbl, name);
+    if (b == NULL)
+        return NULL;
+    return sym_type(sym_res(b->sym));
 }
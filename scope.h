@@ -1,20 +1,56 @@
 #ifndef SCOPE_H
 #define SCOPE_H
 
-// Data structures to keep track of which symbols are visible in a scope.
-// Works like a stack, where new scopes are pushed and popped.
+// Scope level of the global symbols.  Level 0 has the predeclared types and
+// local scopes have levels above the global level.
+#define GLOBAL_SCOPE_LEVEL 1
+
+// Symbol table with the symbols visible in the current scope.  Works like a
+// stack, where new scopes are pushed and popped.
+//
+// Every name maps to its innermost binding, which links to the binding it
+// shadows.  The bindings added in a scope are recorded in an undo log, and
+// popping the scope restores the bindings they shadowed.  Looking up a name
+// is a single hash lookup regardless of how deeply scopes are nested, and
+// pushing and popping scopes does not allocate memory once the log and the
+// free list of bindings have grown to the deepest nesting.
 struct scope {
     struct strmap *symtbl;
     struct strmap *typetbl;
-    struct scope *parent;
+
+    // Bindings added in the current scopes, outermost first.
+    struct binding **log;
+    size_t n_log;
+    size_t max_log;
+
+    // Size of the log when each of the current scopes was pushed.
+    size_t *marks;
+    size_t n_marks;
+    size_t max_marks;
+
+    // Bindings no longer in use.
+    struct binding *free_bindings;
 };
 
-struct scope *scope_new(struct scope *parent, size_t n_syms, size_t n_types);
+struct scope *scope_new(void);
+struct scope *scope_copy(struct scope *scope);
+void scope_del(struct scope *scope);
+void scope_new_gen(void);
+
+void scope_push(struct scope *scope);
+void scope_pop(struct scope *scope);
+
+// Get the level of the current scope.
+static inline unsigned scope_level(struct scope *scope)
+{
+    return scope->n_marks;
+}
 
 void scope_add_sym(struct scope *scope, const char *name, struct sym *sym);
 void scope_add_typesym(struct scope *scope, const char *name, struct sym *sym);
 
 struct sym *scope_get_sym(struct scope *scope, const char *name);
+struct sym *scope_get_global_sym(struct scope *scope, const char *name);
 struct type *scope_get_type(struct scope *scope, const char *name);
 
 #endif // !defined SCOPE_H
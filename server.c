@@ -0,0 +1,619 @@
+#include "zc.h"
+
+// Largest size of the strings of a request.
+#define MAX_REQUEST_SIZE (16 << 20)
+
+// Number of entries of the file table the server may use for the files it keeps
+// ASTs for.  The rest is left for the processes running requests.
+#define MAX_KEPT_FILES (MAX_LOC_FILES / 2)
+
+// Header of a request, sent with the descriptors of the standard input, output
+// and error of the client.  It is followed by n_bytes of NUL-terminated
+// strings: the working directory, argc arguments and envc environment
+// variables.  The server replies with the exit status as an int32_t.
+struct request {
+    uint32_t n_bytes;
+    uint32_t argc;
+    uint32_t envc;
+};
+
+// AST of an included file kept by the server.  It has an arena of its own so
+// it can be freed when the file changes.
+struct kept_ast {
+    uint64_t key;
+    unsigned file;
+    struct ast *ast;
+    struct arena arena;
+};
+
+// The kept ASTs by the canonical path of the file.
+static struct strmap *kept_asts;
+
+// Process running a request.
+struct client {
+    pid_t pid;
+    int conn_fd;      // Connection to the client.
+    int report_fd;    // Included files reported by the process, or -1 after
+                      // the end.
+    bool hung_up;     // Set if the client has gone away.
+    char *report;
+    size_t n_report;
+    size_t max_report;
+};
+
+// In a process running a request, the socket to report included files to the
+// server.  Otherwise -1.
+static int report_fd = -1;
+
+// Pipe the signal handler of the server writes the signals to, so they are
+// handled by the main loop.
+static int signal_fds[2];
+
+static void on_signal(int sig)
+{
+    int saved_errno = errno;
+    char c = sig;
+    if (write(signal_fds[1], &c, 1) < 0) {
+        // The pipe is full, so the main loop has already been woken up.
+    }
+    errno = saved_errno;
+}
+
+// Send or receive all of n bytes.  Returns false on errors or end of file.
+static bool send_all(int fd, const void *data, size_t n)
+{
+    const char *p = data;
+    while (n > 0) {
+        ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void *data, size_t n)
+{
+    char *p = data;
+    while (n > 0) {
+        ssize_t r = recv(fd, p, n, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// Connect to the server listening on the socket at path.  Returns -1 if there
+// is no server.
+static int connect_server(const char *path, struct sockaddr_un *addr)
+{
+    *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr->sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)addr, sizeof *addr) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return fd;
+}
+
+struct ast *server_load_ast(const char *real_path, uint64_t key, unsigned file)
+{
+    if (kept_asts == NULL)
+        return NULL;
+
+    struct kept_ast *kept = strmap_get(kept_asts, real_path);
+    if (kept == NULL || kept->key != key || kept->file != file)
+        return NULL;
+
+    // The includes in the top node are replaced when the AST is used, so a
+    // copy of the top node is returned.  The rest of the AST is not changed by
+    // generating the C code.
+    size_t n_childs;
+    struct ast **childs = ast_asts(kept->ast, &n_childs);
+    struct ast *ast = ast_new_n(kept->ast->loc, SOURCE_FILE, n_childs);
+    memcpy(ast_asts(ast, &n_childs), childs, n_childs * sizeof *childs);
+    return ast;
+}
+
+// Check if the server already keeps the AST of an included file.
+static bool is_kept(struct include_dep *dep)
+{
+    struct kept_ast *kept = kept_asts != NULL ?
+        strmap_get(kept_asts, dep->real_path) : NULL;
+    return kept != NULL && kept->key == dep->key;
+}
+
+void server_report_includes(struct include_dep *deps, size_t n_deps)
+{
+    if (report_fd < 0 || zc_cache_dir == NULL)
+        return;
+
+    // The report is the cache directory the ASTs are stored in and the number
+    // of files, followed by the key, path and canonical path of each file.
+    // Files already kept by the server are left out.
+    size_t n_files = 0;
+    for (size_t i = 0; i < n_deps; i++) {
+        if (deps[i].key != 0 && !is_kept(&deps[i]))
+            n_files++;
+    }
+
+    if (n_files == 0)
+        return;
+
+    char *data;
+    size_t n;
+    FILE *fp = open_memstream(&data, &n);
+    fprintf(fp, "%s%c%zu%c", zc_cache_dir, '\0', n_files, '\0');
+
+    for (size_t i = 0; i < n_deps; i++) {
+        if (deps[i].key != 0 && !is_kept(&deps[i]))
+            fprintf(fp, "%016llx%c%s%c%s%c", (unsigned long long)deps[i].key,
+                    '\0', deps[i].path, '\0', deps[i].real_path, '\0');
+    }
+
+    fclose(fp);
+    send_all(report_fd, data, n);
+    free(data);
+}
+
+// Keep the AST of an included file, which is loaded from the on-disk cache.
+static void keep_ast(const char *cache_dir, const char *path,
+        const char *real_path, uint64_t key)
+{
+    real_path = atom_new(real_path);
+    struct kept_ast *kept = strmap_get(kept_asts, real_path);
+
+    if (kept == NULL && loc_n_files() >= MAX_KEPT_FILES)
+        return;
+
+    struct arena arena = { 0 };
+    struct arena *saved_arena = zc_arena;
+    const char *saved_cache_dir = zc_cache_dir;
+    zc_arena = &arena;
+    zc_cache_dir = cache_dir;
+
+    unsigned file = loc_file(path);
+    struct ast *ast = cache_load_ast(key, file);
+
+    zc_arena = saved_arena;
+    zc_cache_dir = saved_cache_dir;
+
+    if (ast == NULL) {
+        arena_free(&arena);
+        return;
+    }
+
+    if (kept != NULL) {
+        arena_free(&kept->arena);
+    } else {
+        kept = malloc(sizeof *kept);
+        strmap_add(kept_asts, real_path, kept);
+    }
+    *kept = (struct kept_ast){ key, file, ast, arena };
+}
+
+// Get the next string of a report, or NULL at the end.
+static const char *next_str(const char **p, const char *end)
+{
+    const char *s = *p;
+    const char *nul = memchr(s, '\0', end - s);
+    if (nul == NULL)
+        return NULL;
+
+    *p = nul + 1;
+    return s;
+}
+
+// Keep the ASTs of the files reported by the process running a request.  The
+// process sends a report for each translation unit.
+static void keep_reported_asts(struct client *client)
+{
+    const char *p = client->report;
+    const char *end = p + client->n_report;
+
+    while (p < end) {
+        const char *cache_dir = next_str(&p, end);
+        const char *n_files = next_str(&p, end);
+        if (n_files == NULL)
+            return;
+
+        for (size_t i = strtoull(n_files, NULL, 10); i > 0; i--) {
+            const char *key = next_str(&p, end);
+            const char *path = key != NULL ? next_str(&p, end) : NULL;
+            const char *real_path = path != NULL ? next_str(&p, end) : NULL;
+            if (real_path == NULL)
+                return;
+
+            keep_ast(cache_dir, path, real_path, strtoull(key, NULL, 16));
+        }
+    }
+}
+
+// Run the request received on conn_fd in a process forked from the server.
+// fd is the socket to report the included files to.
+static noreturn void run_request(int conn_fd, int fd)
+{
+    // The process runs like czc started by the client, and is killed with the
+    // GCC processes it starts if the client goes away.
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    setpgid(0, 0);
+
+    // Receive the header with the descriptors of the standard streams.
+    struct request req;
+    struct iovec iov = { &req, sizeof req };
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = buf,
+        .msg_controllen = sizeof buf,
+    };
+
+    ssize_t r;
+    while ((r = recvmsg(conn_fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (r != sizeof req || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)) ||
+            req.n_bytes > MAX_REQUEST_SIZE || req.argc > req.n_bytes ||
+            req.envc > req.n_bytes)
+        _exit(1);
+
+    int fds[3];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+    for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    // The strings are the working directory, the arguments and the
+    // environment, each list ended by a NULL pointer.
+    char *data = malloc(req.n_bytes);
+    size_t n_strs = 1 + req.argc + 1 + req.envc + 1;
+    char **strs = malloc(n_strs * sizeof *strs);
+    if (!recv_all(conn_fd, data, req.n_bytes))
+        _exit(1);
+    close(conn_fd);
+
+    char *p = data;
+    char *end = data + req.n_bytes;
+    for (size_t i = 0; i < n_strs; i++) {
+        if (i == 1 + req.argc || i == n_strs - 1) {
+            strs[i] = NULL;
+            continue;
+        }
+
+        char *nul = memchr(p, '\0', end - p);
+        if (nul == NULL) {
+            fprintf(stderr, "error: invalid request to the compile server\n");
+            exit(1);
+        }
+        strs[i] = p;
+        p = nul + 1;
+    }
+
+    if (chdir(strs[0]) < 0) {
+        perror(strs[0]);
+        exit(1);
+    }
+
+    clearenv();
+    for (char **env = &strs[2 + req.argc]; *env != NULL; env++)
+        putenv(*env);
+
+    report_fd = fd;
+    exit(czc_main(req.argc, &strs[1]));
+}
+
+// Remove the client at index i and send it the exit status of its process.
+static void finish_client(struct client *clients, size_t *n_clients, size_t i,
+        int status)
+{
+    struct client *client = &clients[i];
+
+    // Get the rest of the report.  The process has exited, so it can not be
+    // waiting to write it.
+    if (client->report_fd >= 0) {
+        fcntl(client->report_fd, F_SETFL, 0);
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(client->report_fd, buf, sizeof buf)) > 0) {
+            if (client->n_report + n > client->max_report) {
+                client->max_report = (client->n_report + n) * 2;
+                client->report = realloc(client->report, client->max_report);
+            }
+            memcpy(client->report + client->n_report, buf, n);
+            client->n_report += n;
+        }
+        close(client->report_fd);
+    }
+
+    keep_reported_asts(client);
+
+    int32_t exit_status = WIFEXITED(status) ? WEXITSTATUS(status) :
+        128 + WTERMSIG(status);
+    send_all(client->conn_fd, &exit_status, sizeof exit_status);
+
+    close(client->conn_fd);
+    free(client->report);
+    *client = clients[--*n_clients];
+}
+
+// Read what a process has reported so far, so it is not blocked writing.
+static void read_report(struct client *client)
+{
+    for (;;) {
+        if (client->n_report == client->max_report) {
+            client->max_report = client->max_report ?
+                client->max_report * 2 : 4096;
+            client->report = realloc(client->report, client->max_report);
+        }
+
+        ssize_t n = read(client->report_fd, client->report + client->n_report,
+                client->max_report - client->n_report);
+        if (n > 0) {
+            client->n_report += n;
+            continue;
+        }
+
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            close(client->report_fd);
+            client->report_fd = -1;
+        }
+        return;
+    }
+}
+
+noreturn void server_run(const char *path)
+{
+    // Remove the socket of a server which is no longer running.
+    struct sockaddr_un addr;
+    int fd = connect_server(path, &addr);
+    if (fd >= 0)
+        fatal(NO_LOC, "%s: a compile server is already running", path);
+    if (errno == ENAMETOOLONG)
+        fatal(NO_LOC, "%s: %s", path, strerror(errno));
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    // Requests run with the rights of the server, so only its user can
+    // connect.  The socket is created without access for others, so there is
+    // no window before its mode could be changed.
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(0177);
+    int err = listen_fd < 0 ? -1 :
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof addr);
+    umask(mask);
+    if (err < 0 || chmod(path, 0600) < 0 || listen(listen_fd, SOMAXCONN) < 0)
+        fatal(NO_LOC, "%s: %s", path, strerror(errno));
+
+    if (pipe2(signal_fds, O_CLOEXEC | O_NONBLOCK) < 0)
+        fatal(NO_LOC, "pipe: %s", strerror(errno));
+
+    struct sigaction sa = { .sa_handler = on_signal, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    kept_asts = strmap_new(0);
+
+    struct client *clients = NULL;
+    size_t n_clients = 0;
+    size_t max_clients = 0;
+    struct pollfd *fds = NULL;
+    bool quit = false;
+
+    while (!quit) {
+        // Wait for a new client, a signal, a report from a process or a client
+        // going away.
+        fds = realloc(fds, (2 + 2 * n_clients) * sizeof *fds);
+        fds[0] = (struct pollfd){ listen_fd, POLLIN };
+        fds[1] = (struct pollfd){ signal_fds[0], POLLIN };
+        for (size_t i = 0; i < n_clients; i++) {
+            fds[2 + 2 * i] = (struct pollfd){ clients[i].report_fd, POLLIN };
+            fds[3 + 2 * i] = (struct pollfd){
+                clients[i].hung_up ? -1 : clients[i].conn_fd, POLLRDHUP };
+        }
+
+        if (poll(fds, 2 + 2 * n_clients, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fatal(NO_LOC, "poll: %s", strerror(errno));
+        }
+
+        for (size_t i = 0; i < n_clients; i++) {
+            if (fds[2 + 2 * i].revents != 0)
+                read_report(&clients[i]);
+
+            if (fds[3 + 2 * i].revents != 0) {
+                clients[i].hung_up = true;
+                if (kill(-clients[i].pid, SIGTERM) < 0)
+                    kill(clients[i].pid, SIGTERM);
+            }
+        }
+
+        char sigs[64];
+        ssize_t n;
+        while ((n = read(signal_fds[0], sigs, sizeof sigs)) > 0) {
+            for (ssize_t i = 0; i < n; i++)
+                quit |= sigs[i] != SIGCHLD;
+        }
+
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (size_t i = 0; i < n_clients; i++) {
+                if (clients[i].pid == pid) {
+                    finish_client(clients, &n_clients, i, status);
+                    break;
+                }
+            }
+        }
+
+        if (quit || !(fds[0].revents & POLLIN))
+            continue;
+
+        int conn_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        int report_fds[2];
+        if (conn_fd < 0)
+            continue;
+
+        // Refuse clients of other users, in case the socket is reachable by
+        // them anyway.
+        struct ucred cred;
+        socklen_t cred_len = sizeof cred;
+        if (getsockopt(conn_fd, SOL_SOCKET, SO_PEERCRED, &cred,
+                    &cred_len) < 0 || cred.uid != getuid()) {
+            close(conn_fd);
+            continue;
+        }
+
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+                    report_fds) < 0) {
+            close(conn_fd);
+            continue;
+        }
+
+        fflush(NULL);
+        pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            close(signal_fds[0]);
+            close(signal_fds[1]);
+            close(report_fds[0]);
+            for (size_t i = 0; i < n_clients; i++) {
+                close(clients[i].conn_fd);
+                if (clients[i].report_fd >= 0)
+                    close(clients[i].report_fd);
+            }
+            run_request(conn_fd, report_fds[1]);
+        }
+
+        close(report_fds[1]);
+        if (pid < 0) {
+            close(report_fds[0]);
+            close(conn_fd);
+            continue;
+        }
+
+        fcntl(report_fds[0], F_SETFL, O_NONBLOCK);
+        if (n_clients == max_clients) {
+            max_clients = max_clients ? max_clients * 2 : 16;
+            clients = realloc(clients, max_clients * sizeof *clients);
+        }
+        clients[n_clients++] = (struct client){ pid, conn_fd, report_fds[0] };
+    }
+
+    // Let the running requests finish.
+    close(listen_fd);
+    unlink(path);
+
+    while (n_clients > 0) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+            break;
+
+        for (size_t i = 0; i < n_clients; i++) {
+            if (clients[i].pid == pid) {
+                finish_client(clients, &n_clients, i, status);
+                break;
+            }
+        }
+    }
+
+    exit(0);
+}
+
+int server_forward(const char *path, int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    int fd = connect_server(path, &addr);
+    if (fd < 0)
+        return -1;
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    char *data;
+    size_t n;
+    FILE *fp = open_memstream(&data, &n);
+    fprintf(fp, "%s%c", cwd, '\0');
+    for (int i = 0; i < argc; i++)
+        fprintf(fp, "%s%c", argv[i], '\0');
+
+    uint32_t envc = 0;
+    for (char **env = environ; *env != NULL; env++, envc++)
+        fprintf(fp, "%s%c", *env, '\0');
+    fclose(fp);
+    free(cwd);
+
+    // Send the header with the standard streams, then the strings.
+    struct request req = { n, argc, envc };
+    struct iovec iov = { &req, sizeof req };
+    char buf[CMSG_SPACE(3 * sizeof(int))] = { 0 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = buf,
+        .msg_controllen = sizeof buf,
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), (int[]){ 0, 1, 2 }, 3 * sizeof(int));
+
+    ssize_t r;
+    while ((r = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+
+    bool sent = r == sizeof req && send_all(fd, data, n);
+    free(data);
+    if (!sent) {
+        close(fd);
+        return -1;
+    }
+
+    // Once the request has been sent, it can not be run here.
+    int32_t status;
+    if (!recv_all(fd, &status, sizeof status)) {
+        error(NO_LOC, "%s: the compile server did not finish the request",
+                path);
+        status = 1;
+    }
+
+    close(fd);
+    return status;
+}
@@ -0,0 +1,25 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Compile server.  The server listens on a Unix socket and runs each command
+// line forwarded by a client in a process forked from it, with the working
+// directory, environment and standard streams of the client.  The processes
+// start with the state kept warm by the server, which is the ASTs of the files
+// included by earlier requests.
+
+// Run the server listening on the socket at path.  Stops on SIGINT or SIGTERM.
+noreturn void server_run(const char *path);
+
+// Run the command line by the server listening on the socket at path, and get
+// its exit status.  Returns -1 if there is no server.
+int server_forward(const char *path, int argc, char **argv);
+
+// Get the AST kept by the server for the included file real_path with content
+// key, located in file.  Returns NULL if the server has no such AST.
+struct ast *server_load_ast(const char *real_path, uint64_t key, unsigned file);
+
+// Tell the server about the files included by a translation unit, so it can
+// keep their ASTs for later requests.
+void server_report_includes(struct include_dep *deps, size_t n_deps);
+
+#endif // !defined SERVER_H
@@ -0,0 +1,21 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+// SHA-256 hash function, for hashes which have to tell all inputs apart, like
+// the keys of the compile cache.
+#define SHA256_SIZE 32
+
+struct sha256 {
+    uint32_t state[8];
+    uint64_t n;            // Number of bytes hashed.
+    unsigned char buf[64]; // Bytes of the block being filled.
+};
+
+void sha256_init(struct sha256 *ctx);
+void sha256_update(struct sha256 *ctx, const void *data, size_t n);
+void sha256_final(struct sha256 *ctx, unsigned char digest[SHA256_SIZE]);
+
+// Hash n bytes of data.
+void sha256(const void *data, size_t n, unsigned char digest[SHA256_SIZE]);
+
+#endif // !defined SHA256_H
@@ -1,76 +1,173 @@
 #include "zc.h"
 
+// Number of slots allocated when the first key is added to a map created
+// without a size (has to be a power of two).
+#define N_STRMAP_SLOTS_MIN 8
+
+// Slot in the table.  Empty slots have a NULL key.  The hash of the key is
+// kept in the slot so the probe distance of an entry can be computed without
+// rehashing it.
 struct strmap_e {
-	char *key;
-	void *val;
-	struct strmap_e *next;
+    const char *key;
+    void *val;
+    uint32_t h;
 };
 
+// Hash table with open addressing and Robin Hood hashing: an entry being
+// inserted takes the slot of any entry which is closer to its ideal slot, so
+// the probe distances are kept short and a lookup can stop as soon as it
+// passes an entry closer to its ideal slot than the key would be.
 struct strmap {
-	size_t n;
-	struct strmap_e **map;
+    struct strmap_e *slots;
+    size_t n_slots; // Zero or a power of two.
+    size_t n;       // Number of entries.
 };
 
+/* hash an atom by its address using fibonacci hashing */
+static uint32_t atomhash32(const char *s)
+{
+	return ((uint64_t)(uintptr_t)s * 11400714819323198485ULL) >> 32;
+}
+
+// Get the distance of slot i from the ideal slot of hash h.
+static inline size_t probe_dist(struct strmap *map, uint32_t h, size_t i)
+{
+    return (i - h) & (map->n_slots - 1);
+}
+
+// Create a map with room for about n entries before it has to grow.  No
+// memory for the table is allocated until the first key is added.
 struct strmap *strmap_new(size_t n)
 {
     struct strmap *map = malloc(sizeof *map);
-    map->n = n;
-    map->map = calloc(n, sizeof *map->map);
+    map->slots = NULL;
+    map->n_slots = 0;
+    map->n = 0;
+
+    if (n > 0) {
+        size_t n_slots = N_STRMAP_SLOTS_MIN;
+        while (n_slots / 4 * 3 < n)
+            n_slots *= 2;
+
+        map->slots = calloc(n_slots, sizeof *map->slots);
+        map->n_slots = n_slots;
+    }
 
     return map;
 }
 
-/* hash string to 64-bit hash using the fnv-1a 64-bit hash function */
-static uint64_t strhash64(const char *s)
+// Create a map with the same entries as another map.
+struct strmap *strmap_copy(struct strmap *map)
+{
+    struct strmap *copy = malloc(sizeof *copy);
+    copy->slots = NULL;
+    copy->n_slots = map->n_slots;
+    copy->n = map->n;
+
+    if (map->n_slots > 0) {
+        copy->slots = malloc(map->n_slots * sizeof *copy->slots);
+        memcpy(copy->slots, map->slots, map->n_slots * sizeof *copy->slots);
+    }
+
+    return copy;
+}
+
+// Get a pointer to the value of key in the map, or NULL if the key is not in
+// the map.  The pointer is valid until a key is added.
+void **strmap_get_ptr(struct strmap *map, const char *key)
 {
-	uint64_t h = 14695981039346656037ULL;
-	for (int i = 0; s[i] != '\0'; ++i) {
-		h ^= s[i];
-		h *= 1099511628211;
-	}
-	return h;
+    if (map->n == 0)
+        return NULL;
+
+    uint32_t h = atomhash32(key);
+    size_t mask = map->n_slots - 1;
+
+    for (size_t i = h & mask, dist = 0;; i = (i + 1) & mask, dist++) {
+        struct strmap_e *e = &map->slots[i];
+
+        if (e->key == key)
+            return &e->val;
+
+        if (e->key == NULL || probe_dist(map, e->h, i) < dist)
+            return NULL;
+    }
 }
 
 void *strmap_get(struct strmap *map, const char *key)
 {
-    size_t h = strhash64(key) % map->n;
-    for (struct strmap_e *e = map->map[h]; e != NULL; e = e->next) {
-        if (strcmp(key, e->key) == 0)
-            return e->val;
+    void **val = strmap_get_ptr(map, key);
+    return val != NULL ? *val : NULL;
+}
+
+// Insert an entry which is not in the map.  There has to be a free slot.
+static void insert(struct strmap *map, struct strmap_e e)
+{
+    size_t mask = map->n_slots - 1;
+
+    for (size_t i = e.h & mask, dist = 0;; i = (i + 1) & mask, dist++) {
+        struct strmap_e *slot = &map->slots[i];
+
+        if (slot->key == NULL) {
+            *slot = e;
+            map->n++;
+            return;
+        }
+
+        // Take the slot from an entry closer to its ideal slot, and continue
+        // with inserting that entry instead.
+        size_t slot_dist = probe_dist(map, slot->h, i);
+        if (slot_dist < dist) {
+            struct strmap_e tmp = *slot;
+            *slot = e;
+            e = tmp;
+            dist = slot_dist;
+        }
     }
-    return NULL;
 }
 
-void strmap_add(struct strmap *map, const char *key, void *val)
+static void grow(struct strmap *map)
 {
-    int n = strhash64(key) % map->n;
-    struct strmap_e *e = malloc(sizeof *e);
+    struct strmap_e *old_slots = map->slots;
+    size_t old_n_slots = map->n_slots;
 
-    e->key = strdup(key);
-    e->val = val;
-    e->next = map->map[n];
+    map->n_slots = old_n_slots == 0 ? N_STRMAP_SLOTS_MIN : old_n_slots * 2;
+    map->slots = calloc(map->n_slots, sizeof *map->slots);
+    map->n = 0;
+
+    for (size_t i = 0; i < old_n_slots; i++) {
+        if (old_slots[i].key != NULL)
+            insert(map, old_slots[i]);
+    }
 
-    map->map[n] = e;
+    free(old_slots);
 }
 
-void del_strmap_e(struct strmap_e *e, void (*val_free)(void *))
+// Add key with value to the map.  If the key is already in the map its value
+// is replaced.
+void strmap_add(struct strmap *map, const char *key, void *val)
 {
-    if (e == NULL)
+    void **old_val = strmap_get_ptr(map, key);
+    if (old_val != NULL) {
+        *old_val = val;
         return;
+    }
 
-    del_strmap_e(e->next, val_free);
-    free(e->key);
-
-    if (val_free != NULL)
-        val_free(e->val);
+    // Keep the load factor at most 3/4.
+    if ((map->n + 1) * 4 > map->n_slots * 3)
+        grow(map);
 
-    free(e);
+    insert(map, (struct strmap_e){ key, val, atomhash32(key) });
 }
 
 void strmap_del(struct strmap *map, void (*val_free)(void *))
 {
-    for (size_t i = 0; i < map->n; ++i)
-        del_strmap_e(map->map[i], val_free);
+    if (val_free != NULL) {
+        for (size_t i = 0; i < map->n_slots; ++i) {
+            if (map->slots[i].key != NULL)
+                val_free(map->slots[i].val);
+        }
+    }
 
-    free(map->map);
+    free(map->slots);
+    free(map);
 }
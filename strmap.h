@@ -1,10 +1,13 @@
 #ifndef STRMAP_H
 #define STRMAP_H
 
-// Data structure to map strings to void pointers.
+// Data structure to map strings to void pointers.  The keys have to be atoms
+// and are compared by pointer.  The map grows as keys are added, so the size
+// given to strmap_new() is only a hint (0 allocates nothing up front).
 struct strmap;
 
 struct strmap *strmap_new(size_t n);
+struct strmap *strmap_copy(struct strmap *map);
 void **strmap_get_ptr(struct strmap *map, const char *key);
 void *strmap_get(struct strmap *map, const char *key);
 void strmap_add(struct strmap *map, const char *key, void *val);
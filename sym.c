@@ -2,17 +2,17 @@
 
 struct sym *sym_new(struct ast *ast)
 {
-    struct sym *sym = malloc(sizeof (struct decl_sym));
+    // The symbol can become a declaration, whose fields have to start out
+    // cleared, as the arena memory can have been used before.
+    struct decl_sym *sym = arena_alloc(zc_arena, sizeof *sym);
+    *sym = (struct decl_sym){ .sym = { .loc = ast, .tag = UNRES_SYM } };
 
-    sym->loc = ast;
-    sym->tag = UNRES_SYM;
-
-    return sym;
+    return (struct sym *)sym;
 }
 
 struct sym *sym_new_type(struct type *type)
 {
-    struct type_sym *sym = malloc(sizeof *sym);
+    struct type_sym *sym = arena_alloc(zc_arena, sizeof *sym);
 
     sym->sym.loc = NULL;
     sym->sym.tag = TYPE_SYM;
@@ -21,21 +21,15 @@ struct sym *sym_new_type(struct type *type)
     return (struct sym *)sym;
 }
 
-struct sym *sym_res(struct sym *sym)
+static struct sym *res_unres_sym(struct sym *sym)
 {
-    if (sym == NULL)
-        return NULL;
-
-    if (sym->tag != UNRES_SYM)
-        return sym;
-
     switch (sym->loc->tag) {
         case DECL: {
             sym->tag = DECL_SYM;
             struct decl_sym *decl_sym = (struct decl_sym *)sym;
             decl_sym->type = NULL;
             decl_sym->type = type_from_ast(ast_ast(sym->loc, 1));
-            decl_sym->c_name = strdup(ast_s(ast_ast(sym->loc, 0)));
+            decl_sym->c_name = ast_s(ast_ast(sym->loc, 0));
 
             add_global_decl(decl_sym);
             return sym;
@@ -63,6 +57,7 @@ struct sym *sym_res(struct sym *sym)
             sym->tag = ALIAS_SYM;
             struct alias_sym *alias_sym = (struct alias_sym *)sym;
             alias_sym->ast = ast_ast(sym->loc, 1);
+            alias_sym->cache = NULL;
             return sym;
         }
         default:
@@ -70,6 +65,31 @@ struct sym *sym_res(struct sym *sym)
     }
 }
 
+// Resolve a symbol if it is unresolved.
+struct sym *sym_res(struct sym *sym)
+{
+    if (sym == NULL)
+        return NULL;
+
+    if (sym->tag != UNRES_SYM)
+        return sym;
+
+    // Only global symbols are unresolved, and they have to outlive the
+    // function being generated.  They are all resolved in the order they are
+    // declared before the functions are generated in parallel, so the lock is
+    // only a safeguard.
+    lock_globals();
+    if (sym->tag == UNRES_SYM) {
+        struct arena *arena = zc_arena;
+        zc_arena = &zc_tu_arena;
+        res_unres_sym(sym);
+        zc_arena = arena;
+    }
+    unlock_globals();
+
+    return sym;
+}
+
 struct sym *sym_from_ast(struct ast *ast)
 {
     if (ast->tag == DECL) {
@@ -77,7 +97,6 @@ struct sym *sym_from_ast(struct ast *ast)
         decl_sym->sym.loc = ast;
         decl_sym->sym.tag = DECL_SYM;
         decl_sym->type = type_from_ast(ast_ast(decl_sym->sym.loc, 1));
-	decl_sym->type->tag |= LVAL_TYPE_FLAG;
         decl_sym->c_name = gen_c_ident();
 
         return (struct sym *)decl_sym;
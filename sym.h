@@ -12,16 +12,18 @@ struct sym {
     struct ast *loc;
 };
 
-// Alias symbol.
+// Alias symbol.  The expansions of the alias are cached in cache, which is
+// allocated when the alias is first used.
 struct alias_sym {
     struct sym sym;
     struct ast *ast;
+    struct alias_cache *cache;
 };
 
 // Declared symbol.
 struct decl_sym {
     struct sym sym;
-    char *c_name;
+    const char *c_name;
     struct type *type;
     bool is_defined;
 };
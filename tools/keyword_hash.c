@@ -0,0 +1,88 @@
+// Generate the perfect hash table of the keywords used by the lexer.  The
+// keywords are taken from EXPAND_TOKENS, and multipliers are searched for so
+// that every keyword gets a slot of its own.  The table is written to
+// standard output as C code, which lex.c includes.
+
+#include "../zc.h"
+
+// Number of slots in the keyword hash table (has to be a power of two).
+#define N_KEYWORD_SLOTS 64
+
+static const struct {
+    const char *str;
+    const char *name;
+} keywords[] = {
+#define keyword_entry(name, val, keyword) { keyword, #name },
+    EXPAND_TOKENS(keyword_entry)
+#undef keyword_entry
+};
+
+static unsigned mul[3];
+static int slots[N_KEYWORD_SLOTS];
+
+// Has to give the same value as keyword_hash() in lex.c.
+static size_t keyword_hash(const char *s, size_t n)
+{
+    unsigned c0 = (unsigned char)s[0];
+    unsigned c1 = n > 1 ? (unsigned char)s[1] : 0;
+    size_t h = c0 * mul[0] + c1 * mul[1] + n * mul[2];
+    return h & (N_KEYWORD_SLOTS - 1);
+}
+
+// Try to fill the slots using the current multipliers.  Returns false if two
+// keywords hash to the same slot.
+static bool try_fill_slots(void)
+{
+    for (size_t i = 0; i < N_KEYWORD_SLOTS; i++)
+        slots[i] = -1;
+
+    for (size_t i = 0; i < ARRAY_LEN(keywords); i++) {
+        if (keywords[i].str == NULL)
+            continue;
+
+        size_t h = keyword_hash(keywords[i].str, strlen(keywords[i].str));
+        if (slots[h] >= 0)
+            return false;
+        slots[h] = i;
+    }
+
+    return true;
+}
+
+static bool find_multipliers(void)
+{
+    for (mul[0] = 1; mul[0] < N_KEYWORD_SLOTS; mul[0]++) {
+        for (mul[1] = 1; mul[1] < N_KEYWORD_SLOTS; mul[1]++) {
+            for (mul[2] = 1; mul[2] < N_KEYWORD_SLOTS; mul[2]++) {
+                if (try_fill_slots())
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+int main(void)
+{
+    if (!find_multipliers()) {
+        fprintf(stderr, "no perfect hash function found for the keywords\n");
+        return 1;
+    }
+
+    printf("// Generated by tools/keyword_hash.c from EXPAND_TOKENS in lex.h.\n\n");
+    printf("#define N_KEYWORD_SLOTS %d\n", N_KEYWORD_SLOTS);
+    for (size_t i = 0; i < 3; i++)
+        printf("#define KEYWORD_MUL_%zu %u\n", i, mul[i]);
+
+    printf("\nstatic const struct keyword_slot keyword_slots[N_KEYWORD_SLOTS] = {\n");
+    for (size_t h = 0; h < N_KEYWORD_SLOTS; h++) {
+        if (slots[h] < 0)
+            continue;
+        const char *str = keywords[slots[h]].str;
+        printf("    [%zu] = { \"%s\", %zu, %s },\n", h, str, strlen(str),
+                keywords[slots[h]].name);
+    }
+    printf("};\n");
+
+    return 0;
+}
@@ -27,7 +27,7 @@ struct type *void_ptr_type = (struct type *)&(struct ptr_type){ { PTR_TYPE }, vo
 // Compute the size of a basic type
 size_t sizeof_basic_type(struct type *type)
 {
-    switch (type->tag & ~LVAL_TYPE_FLAG) {
+    switch (type->tag) {
         case INT8_TYPE:
         case UINT8_TYPE:
         case CHAR_TYPE:
@@ -109,7 +109,7 @@ const char *int_to_c_type(bool is_signed, size_t size)
 // Get the C type for a basic type
 const char *basic_type_c_name(struct type *type)
 {
-    switch (type->tag & ~LVAL_TYPE_FLAG) {
+    switch (type->tag) {
         case EXTERN_TYPE:
         case VOID_TYPE:
             return "void";
@@ -151,60 +151,241 @@ const char *basic_type_c_name(struct type *type)
 
 struct type *new_selfref_type(struct type_sym *sym)
 {
-    struct selfref_type *type = malloc(sizeof *type);
+    struct selfref_type *type = arena_alloc(zc_arena, sizeof *type);
     type->type.tag = SELFREF_TYPE_FLAG;
     type->sym = sym;
 
     return (struct type *)type;
 }
 
-struct type *new_ptr_type(struct type *to)
+// Initial number of slots in the table of interned types (has to be a power of
+// two).
+#define N_TYPE_SLOTS_INIT 256
+
+// Pointer, array and function types are interned: each distinct type exists
+// once, so types can be compared by pointer.  The types are allocated in the
+// translation unit arena and the table is cleared with reset_types() when the
+// arena is reset.  Uses open addressing with linear probing.
+static struct {
+    struct type **slots;
+    size_t n_slots;
+    size_t n_types;
+    pthread_mutex_t lock;
+} types = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// The parts which identify an interned type.  For pointer types 'of' is the
+// type pointed to and for function types it is the return type.
+struct type_key {
+    enum type_tag tag;
+    struct type *of;
+    size_t len;
+    size_t n_params;
+    struct type **params;
+    bool has_vararg;
+};
+
+static void type_key_of(struct type *t, struct type_key *key)
 {
-    struct ptr_type *type = malloc(sizeof *type);
-    type->type.tag = PTR_TYPE;
-    type->to = to;
+    memset(key, 0, sizeof *key);
+    key->tag = t->tag;
 
-    return (struct type *)type;
+    switch (type_type(t->tag)) {
+        case PTR_TYPE_FLAG:
+            key->of = ptr_type(t)->to;
+            break;
+        case ARRAY_TYPE_FLAG:
+            key->of = array_type(t)->of;
+            key->len = array_type(t)->len;
+            break;
+        case FUNC_TYPE_FLAG:
+            key->of = func_type(t)->ret;
+            key->n_params = func_type(t)->n_params;
+            key->params = func_type(t)->params;
+            key->has_vararg = func_type(t)->has_vararg;
+            break;
+        default:
+            unreachable();
+    }
 }
 
-struct type *new_array_type(struct type *of, size_t len)
+static inline uint64_t hash_mix(uint64_t h, uint64_t v)
 {
-    struct array_type *type = malloc(sizeof *type);
-    type->type.tag = ARRAY_TYPE_FLAG;
-    type->of = of;
-    type->len = len;
+    return (h ^ v) * 1099511628211ULL;
+}
 
-    return (struct type *)type;
+static size_t type_key_hash(const struct type_key *key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    h = hash_mix(h, key->tag);
+    h = hash_mix(h, (uintptr_t)key->of);
+    h = hash_mix(h, key->len);
+    h = hash_mix(h, key->n_params);
+    for (size_t i = 0; i < key->n_params; i++)
+        h = hash_mix(h, (uintptr_t)key->params[i]);
+    h = hash_mix(h, key->has_vararg);
+    return h ^ h >> 32;
 }
 
-struct type *new_func_type(struct type *ret, size_t n_params,
-        struct type *params[], bool has_vararg)
+static bool type_key_equals(const struct type_key *a, const struct type_key *b)
 {
-    struct func_type *type = malloc(sizeof *type +
-            n_params * sizeof *type->params);
-    type->type.tag = FUNC_TYPE_FLAG;
-    type->ret = ret;
-    type->n_params = n_params;
-    type->has_vararg = has_vararg;
-    
-    for (size_t i = 0; i < n_params; i++) {
-        type->params[i] = params[i];
+    if (a->tag != b->tag || a->of != b->of || a->len != b->len ||
+            a->n_params != b->n_params || a->has_vararg != b->has_vararg)
+        return false;
+
+    for (size_t i = 0; i < a->n_params; i++) {
+        if (a->params[i] != b->params[i])
+            return false;
     }
 
-    return (struct type *)type;
+    return true;
+}
+
+static struct type *new_type_from_key(const struct type_key *key)
+{
+    switch (type_type(key->tag)) {
+        case PTR_TYPE_FLAG: {
+            struct ptr_type *type = arena_alloc(&zc_tu_arena, sizeof *type);
+            type->type.tag = key->tag;
+            type->to = key->of;
+            return (struct type *)type;
+        }
+        case ARRAY_TYPE_FLAG: {
+            struct array_type *type = arena_alloc(&zc_tu_arena, sizeof *type);
+            type->type.tag = key->tag;
+            type->of = key->of;
+            type->len = key->len;
+            return (struct type *)type;
+        }
+        case FUNC_TYPE_FLAG: {
+            struct func_type *type = arena_alloc(&zc_tu_arena, sizeof *type +
+                    key->n_params * sizeof *type->params);
+            type->type.tag = key->tag;
+            type->ret = key->of;
+            type->n_params = key->n_params;
+            type->has_vararg = key->has_vararg;
+            for (size_t i = 0; i < key->n_params; i++)
+                type->params[i] = key->params[i];
+            return (struct type *)type;
+        }
+    }
+
+    unreachable();
+    return NULL;
+}
+
+static void insert_type(struct type *type)
+{
+    struct type_key key;
+    type_key_of(type, &key);
+
+    size_t mask = types.n_slots - 1;
+    size_t i = type_key_hash(&key) & mask;
+    while (types.slots[i] != NULL)
+        i = (i + 1) & mask;
+
+    types.slots[i] = type;
+    types.n_types++;
+}
+
+static void grow_types(void)
+{
+    struct type **old_slots = types.slots;
+    size_t old_n_slots = types.n_slots;
+
+    types.n_slots = old_n_slots == 0 ? N_TYPE_SLOTS_INIT : old_n_slots * 2;
+    types.slots = calloc(types.n_slots, sizeof *types.slots);
+    types.n_types = 0;
+
+    if (old_n_slots == 0) {
+        // The predeclared pointer type has to be the interned one.
+        insert_type(void_ptr_type);
+    }
+
+    for (size_t i = 0; i < old_n_slots; i++) {
+        if (old_slots[i] != NULL)
+            insert_type(old_slots[i]);
+    }
+
+    free(old_slots);
+}
+
+// Get the interned type for key, creating it if it does not exist.
+static struct type *find_type(const struct type_key *key)
+{
+    if ((types.n_types + 1) * 2 > types.n_slots)
+        grow_types();
+
+    size_t mask = types.n_slots - 1;
+    for (size_t i = type_key_hash(key) & mask;; i = (i + 1) & mask) {
+        struct type *type = types.slots[i];
+
+        if (type == NULL) {
+            type = new_type_from_key(key);
+            types.slots[i] = type;
+            types.n_types++;
+            return type;
+        }
+
+        struct type_key type_key;
+        type_key_of(type, &type_key);
+        if (type_key_equals(key, &type_key))
+            return type;
+    }
+}
+
+// The table is shared by the threads generating functions.
+static struct type *intern_type(const struct type_key *key)
+{
+    pthread_mutex_lock(&types.lock);
+    struct type *type = find_type(key);
+    pthread_mutex_unlock(&types.lock);
+    return type;
+}
+
+// Forget all interned types.  Has to be called when the translation unit arena
+// is reset.
+void reset_types(void)
+{
+    free(types.slots);
+    types.slots = NULL;
+    types.n_slots = 0;
+    types.n_types = 0;
+}
+
+struct type *new_ptr_type(struct type *to)
+{
+    return intern_type(&(struct type_key){ .tag = PTR_TYPE, .of = to });
+}
+
+struct type *new_array_type(struct type *of, size_t len)
+{
+    return intern_type(&(struct type_key){ .tag = ARRAY_TYPE_FLAG, .of = of,
+            .len = len });
+}
+
+struct type *new_func_type(struct type *ret, size_t n_params,
+        struct type *params[], bool has_vararg)
+{
+    return intern_type(&(struct type_key){ .tag = FUNC_TYPE_FLAG, .of = ret,
+            .n_params = n_params, .params = params,
+            .has_vararg = has_vararg });
 }
 
 struct type *new_struct_type(size_t n_fields, struct field fields[],
         char *cname)
 {
-    struct struct_type *type = malloc(sizeof *type +
+    struct struct_type *type = arena_alloc(zc_arena, sizeof *type +
             n_fields * sizeof *type->fields);
 
     type->type.tag = STRUCT_TYPE_FLAG;
     type->cname = cname;
     type->n_fields = n_fields;
     type->is_defined = false;
-    type->id = zc_n_struct_types++;
+    type->id = __atomic_fetch_add(&zc_n_struct_types, 1, __ATOMIC_RELAXED);
+    type->job = zc_job;
+    type->has_layout = false;
+    type->field_index = NULL;
+    type->field_index_mask = 0;
     for (size_t i = 0; i < n_fields; i++)
         type->fields[i] = fields[i];
 
@@ -213,9 +394,9 @@ struct type *new_struct_type(size_t n_fields, struct field fields[],
 
 struct type *new_extern_type(void)
 {
-    struct extern_type *type = malloc(sizeof *type);
+    struct extern_type *type = arena_alloc(zc_arena, sizeof *type);
     type->type.tag = EXTERN_TYPE_FLAG;
-    type->id = zc_n_struct_types++;
+    type->id = __atomic_fetch_add(&zc_n_struct_types, 1, __ATOMIC_RELAXED);
     return (struct type *)type;
 }
 
@@ -242,6 +423,73 @@ struct struct_type *struct_type(struct type *t)
     return (struct struct_type *)t;
 }
 
+// Structures with fewer fields than this are searched linearly instead of
+// building an index.
+#define N_FIELDS_INDEX_MIN 8
+
+static inline size_t field_hash(const char *name)
+{
+    return ((uint64_t)(uintptr_t)name * 11400714819323198485ULL) >> 32;
+}
+
+// Build the index of the fields of a structure.  Returns the name of a
+// duplicate field, or NULL if all names are unique.  The index is allocated in
+// the translation unit arena, as it can be built while generating a function
+// for a structure which outlives it.
+static const char *build_field_index(struct struct_type *type)
+{
+    size_t n_slots = 16;
+    while (n_slots < type->n_fields * 2)
+        n_slots *= 2;
+
+    uint32_t *slots = arena_alloc(&zc_tu_arena, n_slots * sizeof *slots);
+    memset(slots, 0, n_slots * sizeof *slots);
+
+    size_t mask = n_slots - 1;
+    for (size_t i = 0; i < type->n_fields; i++) {
+        const char *name = type->fields[i].name;
+        size_t j = field_hash(name) & mask;
+
+        for (; slots[j] != 0; j = (j + 1) & mask) {
+            if (type->fields[slots[j] - 1].name == name)
+                return name;
+        }
+        slots[j] = i + 1;
+    }
+
+    // The index is set last, as other threads use it without taking the lock
+    // once it is set.
+    type->field_index_mask = mask;
+    __atomic_store_n(&type->field_index, slots, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+ptrdiff_t struct_field_index(struct struct_type *type, const char *name)
+{
+    if (type->n_fields < N_FIELDS_INDEX_MIN) {
+        for (size_t i = 0; i < type->n_fields; i++) {
+            if (type->fields[i].name == name)
+                return i;
+        }
+        return -1;
+    }
+
+    if (__atomic_load_n(&type->field_index, __ATOMIC_ACQUIRE) == NULL) {
+        lock_globals();
+        if (type->field_index == NULL && build_field_index(type) != NULL)
+            bug("duplicate field in structure");
+        unlock_globals();
+    }
+
+    uint32_t *slots = type->field_index;
+    size_t mask = type->field_index_mask;
+    for (size_t j = field_hash(name) & mask; slots[j] != 0; j = (j + 1) & mask) {
+        if (type->fields[slots[j] - 1].name == name)
+            return slots[j] - 1;
+    }
+    return -1;
+}
+
 struct extern_type *extern_type(struct type *t)
 {
     return (struct extern_type *)t;
@@ -338,9 +586,9 @@ static struct type *type_from_name_ast(struct ast *ast)
 static struct field field_from_decl(struct ast *ast)
 {
     struct field field;
-    field.name = strdup(ast_s(ast_ast(ast, 0)));
+    field.name = ast_s(ast_ast(ast, 0));
     field.type = type_from_ast(ast_ast(ast, 1));
-    field.type->tag |= LVAL_TYPE_FLAG;
+    field.offset = 0;
     return field;
 }
 
@@ -349,24 +597,39 @@ static struct type *type_from_struct_ast(struct ast *ast)
 {
     size_t n_fields;
     struct ast **asts = ast_asts(ast, &n_fields);
-    struct struct_type *type = malloc(sizeof *type +
+    struct struct_type *type = arena_alloc(zc_arena, sizeof *type +
             n_fields * sizeof (struct field));
 
+    // The name is referenced by the structure definition which is part of the
+    // translation unit, even if the structure is local to a function.
+    type->cname = gen_c_global_ident();
+
     type->type.tag = STRUCT_TYPE_FLAG;
-    type->cname = gen_c_ident();
     type->n_fields = n_fields;
     type->is_defined = false;
-    type->id = zc_n_struct_types++;
+    type->id = __atomic_fetch_add(&zc_n_struct_types, 1, __ATOMIC_RELAXED);
+    type->job = zc_job;
+    type->has_layout = false;
+    type->field_index = NULL;
+    type->field_index_mask = 0;
 
     for (size_t i = 0; i < n_fields; ++i)
         type->fields[i] = field_from_decl(asts[i]);
 
-    for (size_t i = 0; i < n_fields; ++i) {
-        for (size_t j = i + 1; j < n_fields; ++j) {
-            const char *a = type->fields[i].name, *b = type->fields[j].name;
-            if (strcmp(a, b) == 0)
-                fatal(ast->loc, "duplicate member %s in structure", a);
+    if (n_fields < N_FIELDS_INDEX_MIN) {
+        for (size_t i = 0; i < n_fields; ++i) {
+            for (size_t j = i + 1; j < n_fields; ++j) {
+                const char *a = type->fields[i].name, *b = type->fields[j].name;
+                if (a == b)
+                    fatal(ast->loc, "duplicate member %s in structure", a);
+            }
         }
+    } else {
+        // Wide structures get their index up front, as it finds duplicates
+        // in linear time.
+        const char *dup = build_field_index(type);
+        if (dup != NULL)
+            fatal(ast->loc, "duplicate member %s in structure", dup);
     }
 
     return (struct type *)type;
@@ -390,105 +653,10 @@ struct type *type_from_ast(struct ast *ast)
     abort();
 }
 
-// Compare types for equality.
-bool type_equals(struct type *a, struct type *b)
-{
-    if (type_type(a->tag) != type_type(b->tag))
-        return false;
-
-    switch (type_type(a->tag)) {
-        case PTR_TYPE_FLAG: {
-            struct ptr_type *a2 = ptr_type(a);
-            struct ptr_type *b2 = ptr_type(b);
-
-            return type_equals(a2->to, b2->to);
-        }
-        case ARRAY_TYPE_FLAG: {
-            struct array_type *a2 = array_type(a);
-            struct array_type *b2 = array_type(b);
-
-            if (a2->len != b2->len)
-                return false;
-
-            return type_equals(a2->of, b2->of);
-        }
-        case FUNC_TYPE_FLAG: {
-            struct func_type *a2 = func_type(a);
-            struct func_type *b2 = func_type(b);
-
-            if (a2->n_params != b2->n_params)
-                return false;
-
-            for (size_t i = 0; i < a2->n_params; ++i) {
-                if (!type_equals(a2->params[i], b2->params[i]))
-                    return false;
-            }
-
-            return type_equals(a2->ret, b2->ret);
-        }
-
-        case VOID_TYPE_FLAG:
-        case BOOL_TYPE_FLAG:
-        case INT_TYPE_FLAG:
-        case FLOAT_TYPE_FLAG:
-            return (a->tag & ~LVAL_TYPE_FLAG) == (b->tag & ~LVAL_TYPE_FLAG);
-
-        case STRUCT_TYPE_FLAG:
-            return struct_type(a)->id == struct_type(b)->id;
-
-        case EXTERN_TYPE_FLAG:
-            return extern_type(a)->id == extern_type(b)->id;
-    }
-
-    unreachable();
-    return false;
-}
-
 void type_del(struct type *type)
 {
 }
 
-// Duplicate a type.
-struct type *type_dup(struct type *t, enum type_tag flags)
-{
-    struct type *t2;
-    switch (type_type(t->tag)) {
-        case VOID_TYPE_FLAG:
-        case BOOL_TYPE_FLAG:
-        case INT_TYPE_FLAG:
-        case FLOAT_TYPE_FLAG:
-            t2 = malloc(sizeof *t2);
-            memcpy(t2, t, sizeof *t2);
-            break;
-        case PTR_TYPE_FLAG:
-            t2 = malloc(sizeof (struct ptr_type));
-            memcpy(t2, t, sizeof (struct ptr_type));
-            break;
-        case ARRAY_TYPE_FLAG:
-            t2 = malloc(sizeof (struct array_type));
-            memcpy(t2, t, sizeof (struct array_type));
-            break;
-        case FUNC_TYPE_FLAG: {
-            struct func_type *t_ = (struct func_type *)t;
-            size_t n = sizeof *t_ + t_->n_params * sizeof *t_->params;
-            struct func_type *t2_ = malloc(n);
-            t2 = (struct type *)memcpy(t2_, t, n);
-            break;
-        }
-        case STRUCT_TYPE_FLAG: {
-            struct struct_type *t_ = (struct struct_type *)t;
-            size_t n = sizeof *t_ + t_->n_fields * sizeof *t_->fields;
-            struct struct_type *t2_ = malloc(n);
-            t2 = (struct type *)memcpy(t2_, t, n);
-            break;
-        }
-        default:
-            unreachable();
-    }
-    t2->tag = (t2->tag & ~LVAL_TYPE_FLAG) | flags;
-    return t2;
-}
-
 bool resolve_selfref(struct type **type, bool selfref_ok);
 bool resolve_selfref_struct(struct struct_type *type, bool selfref_ok)
 {
@@ -499,8 +667,10 @@ bool resolve_selfref_struct(struct struct_type *type, bool selfref_ok)
         struct field *field = &fields[i];
 
         if (is_ptr_type(field->type)) {
-            if (!resolve_selfref(&ptr_type(field->type)->to, true))
+            struct type *to = ptr_type(field->type)->to;
+            if (!resolve_selfref(&to, true))
                 return false;
+            field->type = new_ptr_type(to);
         } else {
             if (!resolve_selfref(&field->type, false))
                 return false;
@@ -511,11 +681,11 @@ bool resolve_selfref_struct(struct struct_type *type, bool selfref_ok)
 
 // Resolve self referencing types in a type.  Can only resolve self referencing
 // types if they are referenced by a pointer contained in a structure (as that
-// is what C permits).
+// is what C permits).  Interned types are never changed, so a type containing
+// a resolved type is replaced by the interned type with the resolved type.
 //
 // A better solution would probably have been to have a seperate type for named
-// types.  That would also avoid having to copy large structure types around,
-// and simplify comparing types for equality.
+// types.  That would also avoid having to copy large structure types around.
 bool resolve_selfref(struct type **type, bool selfref_ok)
 {
     switch (type_type((*type)->tag)) {
@@ -524,15 +694,36 @@ bool resolve_selfref(struct type **type, bool selfref_ok)
                 *type = selfref_type(*type)->sym->type;
             }
             return selfref_ok;
-        case PTR_TYPE_FLAG:
-            return resolve_selfref(&ptr_type(*type)->to, selfref_ok);
-        case ARRAY_TYPE_FLAG:
-            return resolve_selfref(&array_type(*type)->of, selfref_ok);
-        case FUNC_TYPE_FLAG:
-            for (size_t i = 0; i < func_type(*type)->n_params; i++)
-                if (!resolve_selfref(&func_type(*type)->params[i], selfref_ok))
+        case PTR_TYPE_FLAG: {
+            struct type *to = ptr_type(*type)->to;
+            if (!resolve_selfref(&to, selfref_ok))
+                return false;
+            *type = new_ptr_type(to);
+            return true;
+        }
+        case ARRAY_TYPE_FLAG: {
+            struct type *of = array_type(*type)->of;
+            if (!resolve_selfref(&of, selfref_ok))
+                return false;
+            *type = new_array_type(of, array_type(*type)->len);
+            return true;
+        }
+        case FUNC_TYPE_FLAG: {
+            struct func_type *t = func_type(*type);
+            struct type *params[t->n_params + 1];
+            struct type *ret = t->ret;
+
+            for (size_t i = 0; i < t->n_params; i++) {
+                params[i] = t->params[i];
+                if (!resolve_selfref(&params[i], selfref_ok))
                     return false;
-            return resolve_selfref(&func_type(*type)->ret, selfref_ok);
+            }
+            if (!resolve_selfref(&ret, selfref_ok))
+                return false;
+
+            *type = new_func_type(ret, t->n_params, params, t->has_vararg);
+            return true;
+        }
         case STRUCT_TYPE_FLAG:
             return resolve_selfref_struct(struct_type(*type), selfref_ok);
     }
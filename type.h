@@ -46,10 +46,7 @@ enum type_tag {
     EXTERN_TYPE = 0x0200,
 
     // Flag which defines the type kind
-    TYPE_MASK = 0x03FF,
-
-    // Flag set when the type is an lvalue
-    LVAL_TYPE_FLAG = 0x0400
+    TYPE_MASK = 0x03FF
 };
 
 struct type {
@@ -87,6 +84,7 @@ struct func_type {
 struct field {
     const char *name;
     struct type *type;
+    size_t offset; // Set when the layout of the structure is computed.
 };
 
 struct extern_type {
@@ -100,6 +98,20 @@ struct struct_type {
     size_t n_fields;
     bool is_defined;
     int id;
+    struct func_job *job; // The function it is local to, or NULL if global.
+
+    // Layout of the structure, computed once by struct_layout().  The size
+    // includes the trailing padding.
+    bool has_layout;
+    size_t size;
+    size_t align;
+
+    // Hash table of field indices plus one by name, built by
+    // struct_field_index() when a field of a wide structure is first looked
+    // up.  Zero marks an empty slot.
+    uint32_t *field_index;
+    size_t field_index_mask;
+
     struct field fields[];
 };
 
@@ -146,16 +158,14 @@ static inline enum type_tag type_type(enum type_tag tag)
     return tag & TYPE_MASK;
 }
 
-static inline void type_set_flags(struct type *t, enum type_tag flags) {
-    t->tag |= (flags & LVAL_TYPE_FLAG);
-}
-
-static inline void type_clr_flags(struct type *t, enum type_tag flags) {
-    t->tag &= ~(flags & LVAL_TYPE_FLAG);
+// Compare types for equality.  Pointer, array and function types are interned
+// and there is only one of every other type, so equal types are the same
+// object.
+static inline bool type_equals(struct type *a, struct type *b)
+{
+    return a == b;
 }
 
-bool type_equals(struct type *a, struct type *b);
-
 static inline bool is_void_type(struct type *t)
 {
     return t->tag & VOID_TYPE_FLAG;
@@ -206,11 +216,6 @@ static inline bool is_extern_type(struct type *t)
     return t->tag & EXTERN_TYPE_FLAG;
 }
 
-static inline bool is_lval_type(struct type *t)
-{
-    return t->tag & LVAL_TYPE_FLAG;
-}
-
 struct selfref_type *selfref_type(struct type *t);
 
 struct ptr_type *ptr_type(struct type *t);
@@ -219,8 +224,12 @@ struct func_type *func_type(struct type *t);
 struct struct_type *struct_type(struct type *t);
 struct extern_type *extern_type(struct type *t);
 
+// Get the index of the field with name in a structure, or -1 if there is no
+// such field.  The name has to be an atom.
+ptrdiff_t struct_field_index(struct struct_type *type, const char *name);
+
 void type_del(struct type *t);
-struct type *type_dup(struct type *t, enum type_tag flags);
+void reset_types(void);
 
 struct type *type_from_ast(struct ast *ast);
 bool resolve_selfref(struct type **type, bool selfref_ok);
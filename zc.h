@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdnoreturn.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -13,46 +14,83 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
 #include <ctype.h>
-
+#include <limits.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "arena.h"
+#include "sha256.h"
 #include "loc.h"
 #include "ast.h"
 #include "type.h"
 #include "lex.h"
 #include "parse.h"
 #include "rope.h"
+#include "atom.h"
 #include "strmap.h"
 #include "error.h"
 #include "eval.h"
 #include "sym.h"
 #include "codegen.h"
 #include "scope.h"
+#include "cache.h"
+#include "server.h"
 #include "zc.h"
 
 #define ARRAY_LEN(A) (sizeof (A) / sizeof (*A))
 
+// The number of threads used to generate the functions of a translation unit.
+#define MAX_JOBS 256
+extern int zc_n_jobs;
+
+// Write the C code of each function as soon as it has been generated, rather
+// than keeping the code of the translation unit until it has all been
+// generated.  The functions are generated by one thread.
+extern bool zc_stream_output;
+
+// Directory of the on-disk cache, or NULL if the cache is disabled.
+extern const char *zc_cache_dir;
+
+// Run the compiler with the command line argv.  Returns the exit status.
+int czc_main(int argc, char **argv);
+
+// The thread-local variables below hold the state of the code being generated,
+// so each thread generating functions has its own.
+
 // The amount of nested loops (used to know when continue or break is allowed)
-extern int zc_loop_level;
+extern _Thread_local int zc_loop_level;
 
 // The amount of nested switch statements (used to know when fallthrough
 // is allowed)
 extern int zc_switch_level;
 
 // The current indentation level when generating C code.
-extern int zc_indent_level;
+extern _Thread_local int zc_indent_level;
 
 // This variable is incremented for each structure created.  It is used to give
-// each structure an id when is used for comparing them for equality.
+// each structure a unique id.
 extern int zc_n_struct_types;
 
-// The current local scope.
-extern struct scope *current_scope;
+// Incremented each time the visible symbols change.  Used to invalidate the
+// types cached in the AST by eval_type().
+extern _Thread_local unsigned zc_scope_gen;
 
-// The scope with all global symbols.
-extern struct scope *global_scope;
+// The symbol table with the symbols visible in the current scope.
+extern _Thread_local struct scope *current_scope;
 
 // Return type of current function being generated
-extern struct type *zc_func_ret_type;
+extern _Thread_local struct type *zc_func_ret_type;
 
 // The global type declarations
 extern struct rope *zc_type_decls_rope;
@@ -67,9 +105,22 @@ extern struct rope *zc_prog_decls_rope;
 extern struct rope *zc_prog_defs_rope;
 
 // The local variable declarations in the current function
-extern struct rope *zc_func_decls_rope;
+extern _Thread_local struct rope *zc_func_decls_rope;
 
 // Labels (used or defined) in the current function
-extern struct strmap *zc_func_labels;
+extern _Thread_local struct strmap *zc_func_labels;
+
+// Arena for objects which live until the C code for the translation unit has
+// been generated: the AST, global symbols and types, and the output ropes.
+// The arena of a thread generating functions is kept until the output has been
+// written.
+extern _Thread_local struct arena zc_tu_arena;
+
+// Arena for objects only used while generating the C code for a function.  It
+// is reset after each function.
+extern _Thread_local struct arena zc_func_arena;
+
+// The arena new objects are allocated from.
+extern _Thread_local struct arena *zc_arena;
 
 #endif // !defined ZC_H